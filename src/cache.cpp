@@ -0,0 +1,454 @@
+#include "cache.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <grp.h>
+    #include <pwd.h>
+    #include <unistd.h>
+
+    #ifdef __linux__
+        #include <linux/magic.h>
+        #include <linux/xattr.h>
+        #include <mntent.h>
+        #include <sys/sysmacros.h>
+        #include <sys/vfs.h>
+        #include <sys/xattr.h>
+    #elif __APPLE__
+        #include <sys/param.h>
+        #include <sys/ucred.h>
+        #include <sys/mount.h>
+    #endif
+}
+
+StatCache statcache;
+MountIndex mountindex;
+FsCaps fscaps;
+IdCache idcache;
+
+int StatCache::lookup(const std::string &path, struct stat *st, bool follow)
+{
+    shard_t &shard = shards.at(std::hash<std::string>()(path) % CACHE_SHARDS);
+    auto &map = follow ? shard.stat : shard.lstat;
+
+    nlookups++;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        auto found = map.find(path);
+
+        if (found != map.end()) {
+            nhits++;
+
+            *st = found->second.st;
+            errno = found->second.error;
+            return found->second.result;
+        }
+    }
+
+    result_t res = {0, 0, {}};
+
+    res.result = follow ? ::stat(path.c_str(), &res.st) :
+                 ::lstat(path.c_str(), &res.st);
+    res.error = (res.result != 0) ? errno : 0;
+
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+        map.emplace(path, res);
+    }
+
+    *st = res.st;
+    errno = res.error;
+    return res.result;
+}
+
+int StatCache::stat(const std::string &path, struct stat *st)
+{
+    return lookup(path, st, true);
+}
+
+int StatCache::lstat(const std::string &path, struct stat *st)
+{
+    return lookup(path, st, false);
+}
+
+bool StatCache::exists(const std::string &path)
+{
+    struct stat st = {0};
+    return (lookup(path, &st, true) == 0);
+}
+
+#ifdef __linux__
+// mountinfo escapes blanks and backslashes in paths as \ooo
+static std::string unescape(const std::string &field)
+{
+    std::string output;
+    output.reserve(field.length());
+
+    for (size_t i = 0; i < field.length(); i++) {
+        if (
+            field[i] == '\\' && i + 3 < field.length() &&
+            field[i + 1] >= '0' && field[i + 1] <= '7'
+        ) {
+            output += static_cast<char>(
+                          std::strtol(field.substr(i + 1, 3).c_str(), nullptr, 8)
+                      );
+            i += 3;
+        } else {
+            output += field[i];
+        }
+    }
+
+    return output;
+}
+#endif
+
+void MountIndex::load()
+{
+    #ifdef __linux__
+
+    FILE *fp = fopen("/proc/self/mountinfo", "re");
+
+    if (fp != nullptr) {
+        char *line = nullptr;
+        size_t len = 0;
+
+        /*
+         * id parent major:minor root dir options [optional...] - type
+         * source super-options
+         */
+        while (getline(&line, &len, fp) != -1) {
+            std::istringstream fields(line);
+            std::string field;
+
+            uint64_t id = 0;
+            unsigned int major = 0;
+            unsigned int minor = 0;
+            mount_t mnt;
+
+            fields >> id >> field >> field;
+
+            if (sscanf(field.c_str(), "%u:%u", &major, &minor) != 2) {
+                continue;
+            }
+
+            fields >> field >> mnt.dir;
+
+            while (fields >> field && field != "-") {
+            }
+
+            fields >> mnt.type >> mnt.source;
+
+            if (mnt.type.empty() || mnt.type == "autofs") {
+                continue;
+            }
+
+            mnt.dir = unescape(mnt.dir);
+            mnt.source = unescape(mnt.source);
+
+            mounts.push_back(mnt);
+            ids.emplace(id, mounts.size() - 1);
+            devs.emplace(makedev(major, minor), mounts.size() - 1);
+        }
+
+        free(line); // NOLINT
+        fclose(fp);
+
+        return;
+    }
+
+    // no /proc, the device ids have to come from stat()ing every mount
+    fp = setmntent(MOUNTED, "r");
+
+    if (fp != nullptr) {
+        struct mntent *mnt = nullptr;
+        struct mntent mntbuf = {nullptr};
+        char buf[PATH_MAX * 4] = {0};
+
+        while ((mnt = getmntent_r(fp, &mntbuf, &buf[0], sizeof(buf))) != nullptr) {
+            if (strcmp(mnt->mnt_type, "autofs") != 0) {
+                mounts.push_back({mnt->mnt_dir, mnt->mnt_fsname, mnt->mnt_type});
+            }
+        }
+
+        endmntent(fp);
+    }
+
+    #elif __APPLE__
+
+    struct statfs *entries;
+    int num = getmntinfo(&entries, MNT_WAIT);
+
+    for (int i = 0; i < num; i++) {
+        mounts.push_back({
+            entries[i].f_mntonname,
+            entries[i].f_mntfromname,
+            entries[i].f_fstypename
+        });
+
+        devs.emplace(entries[i].f_fsid.val[0], mounts.size() - 1);
+    }
+
+    #endif
+}
+
+void MountIndex::statmounts()
+{
+    struct stat st = {0};
+
+    for (size_t i = 0; i < mounts.size(); i++) {
+        if (statcache.stat(mounts[i].dir, &st) == 0) {
+            statdevs.emplace(st.st_dev, i);
+        }
+    }
+}
+
+const mount_t *MountIndex::find(const std::string &path, dev_t dev)
+{
+    std::call_once(loaded, [this]() {
+        load();
+    });
+
+    #ifdef STATX_MNT_ID
+
+    struct statx stx = {0};
+
+    /*
+     * The kernel knows which mount a path is on and whether it is the
+     * root of it, no need to guess from device ids.
+     */
+    if (
+        !ids.empty() &&
+        statx(
+            AT_FDCWD,
+            path.c_str(),
+            AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC,
+            STATX_MNT_ID,
+            &stx
+        ) == 0 &&
+        (stx.stx_mask & STATX_MNT_ID) != 0
+    ) {
+        if (
+            (stx.stx_attributes_mask & STATX_ATTR_MOUNT_ROOT) != 0 &&
+            (stx.stx_attributes & STATX_ATTR_MOUNT_ROOT) == 0
+        ) {
+            return nullptr;
+        }
+
+        auto found = ids.find(stx.stx_mnt_id);
+        return (found != ids.end()) ? &mounts[found->second] : nullptr;
+    }
+
+    #else
+
+    (void)path;
+
+    #endif
+
+    auto found = devs.find(dev);
+
+    if (found != devs.end()) {
+        return &mounts[found->second];
+    }
+
+    /*
+     * Some filesystems (btrfs subvolumes for one) report another device
+     * to stat() than in the mount table, so fall back to what stat() says
+     * about each mount directory.
+     */
+    std::call_once(statted, [this]() {
+        statmounts();
+    });
+
+    found = statdevs.find(dev);
+    return (found != statdevs.end()) ? &mounts[found->second] : nullptr;
+}
+
+fscaps_t FsCaps::probe(const std::string &path)
+{
+    fscaps_t caps = {true};
+
+    #ifdef __linux__
+
+    struct statfs fs = {};
+
+    if (statfs(path.c_str(), &fs) == 0) {
+        switch (fs.f_type) {
+            case PROC_SUPER_MAGIC:
+            case SYSFS_MAGIC:
+            case DEVPTS_SUPER_MAGIC:
+            case CGROUP_SUPER_MAGIC:
+            case CGROUP2_SUPER_MAGIC:
+            case DEBUGFS_MAGIC:
+            case TRACEFS_MAGIC:
+            case SECURITYFS_MAGIC:
+            case PSTOREFS_MAGIC:
+            case BPF_FS_MAGIC:
+            case NSFS_MAGIC:
+                caps.acl = false;
+                return caps;
+
+            default:
+                break;
+        }
+    }
+
+    // tmpfs, nfs and friends only have ACLs when mounted or built with them
+    if (
+        lgetxattr(path.c_str(), XATTR_NAME_POSIX_ACL_ACCESS, nullptr, 0) < 0 &&
+        errno == EOPNOTSUPP
+    ) {
+        caps.acl = false;
+    }
+
+    #else
+
+    (void)path;
+
+    #endif
+
+    return caps;
+}
+
+fscaps_t FsCaps::get(dev_t dev, const std::string &path)
+{
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        auto found = devs.find(dev);
+
+        if (found != devs.end()) {
+            return found->second;
+        }
+    }
+
+    fscaps_t caps = probe(path);
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    return devs.emplace(dev, caps).first->second;
+}
+
+bool IdCache::find(shard_t *shard, uint32_t id, std::string *name)
+{
+    std::shared_lock<std::shared_mutex> guard(shard->lock);
+    auto found = shard->names.find(id);
+
+    if (found == shard->names.end()) {
+        return false;
+    }
+
+    *name = found->second;
+    return true;
+}
+
+void IdCache::store(shard_t *shard, uint32_t id, const std::string &name)
+{
+    std::unique_lock<std::shared_mutex> guard(shard->lock);
+    shard->names.emplace(id, name);
+}
+
+std::string IdCache::user(uid_t uid)
+{
+    shard_t &shard = users.at(uid % CACHE_SHARDS);
+    std::string name;
+
+    if (find(&shard, uid, &name)) {
+        return name;
+    }
+
+    struct passwd pw = {nullptr};
+    struct passwd *pwp = nullptr;
+    std::vector<char> buf(PATH_MAX);
+
+    while (getpwuid_r(uid, &pw, buf.data(), buf.size(), &pwp) == ERANGE) {
+        buf.resize(buf.size() * 2);
+    }
+
+    if (pwp != nullptr && pwp->pw_name != nullptr && *pwp->pw_name != '\0') {
+        name = pwp->pw_name;
+    } else {
+        name = std::to_string(uid);
+    }
+
+    store(&shard, uid, name);
+    return name;
+}
+
+std::string IdCache::group(gid_t gid)
+{
+    shard_t &shard = groups.at(gid % CACHE_SHARDS);
+    std::string name;
+
+    if (find(&shard, gid, &name)) {
+        return name;
+    }
+
+    struct group gr = {nullptr};
+    struct group *grp = nullptr;
+    std::vector<char> buf(PATH_MAX);
+
+    while (getgrgid_r(gid, &gr, buf.data(), buf.size(), &grp) == ERANGE) {
+        buf.resize(buf.size() * 2);
+    }
+
+    if (grp != nullptr && grp->gr_name != nullptr && *grp->gr_name != '\0') {
+        name = grp->gr_name;
+    } else {
+        name = std::to_string(gid);
+    }
+
+    store(&shard, gid, name);
+    return name;
+}
+
+// both files are name:password:id:...
+void IdCache::load(const char *file, std::array<shard_t, CACHE_SHARDS> *shards)
+{
+    FILE *fp = fopen(file, "re");
+
+    if (fp == nullptr) {
+        return;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+
+    while (getline(&line, &len, fp) != -1) {
+        char *name = line;
+        char *pass = strchr(name, ':');
+        char *id = (pass != nullptr) ? strchr(pass + 1, ':') : nullptr;
+
+        if (id == nullptr || *name == '#' || *name == '+' || *name == '-') {
+            continue;
+        }
+
+        *pass = '\0';
+
+        char *end = nullptr;
+        unsigned long num = strtoul(id + 1, &end, 10);
+
+        if (end == id + 1 || *end != ':' || *name == '\0') {
+            continue;
+        }
+
+        // like getpwuid() the first entry for an id wins
+        store(&shards->at(num % CACHE_SHARDS), static_cast<uint32_t>(num), name);
+    }
+
+    free(line); // NOLINT
+    fclose(fp);
+}
+
+void IdCache::preload()
+{
+    load("/etc/passwd", &users);
+    load("/etc/group", &groups);
+}
@@ -0,0 +1,177 @@
+// NOLINTNEXTLINE
+#ifndef CACHE_HPP_
+#define CACHE_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <sys/stat.h>
+#include <sys/types.h>
+}
+
+#define CACHE_SHARDS 16
+
+/*
+ * Remembers the result of every stat/lstat done through it for the rest
+ * of the run, failures included, so paths that several parts of a listing
+ * look at (parent directories, link targets, .git probes) only cost one
+ * syscall. Safe to use from several threads.
+ */
+class StatCache
+{
+public:
+    StatCache() = default;
+    virtual ~StatCache() = default;
+
+    StatCache(const StatCache &) = delete;
+    StatCache(StatCache &&other) = delete;
+    StatCache &operator=(const StatCache &other) = delete;
+    StatCache &operator=(StatCache &&other) = delete;
+
+    int stat(const std::string &path, struct stat *st);
+    int lstat(const std::string &path, struct stat *st);
+    bool exists(const std::string &path);
+
+    size_t lookups() const { return nlookups; }
+    size_t hits() const { return nhits; }
+private:
+    struct result_t {
+        int result;
+        int error;
+        struct stat st;
+    };
+
+    struct shard_t {
+        std::shared_mutex lock;
+        std::unordered_map<std::string, result_t> stat;
+        std::unordered_map<std::string, result_t> lstat;
+    };
+
+    std::array<shard_t, CACHE_SHARDS> shards;
+
+    std::atomic<size_t> nlookups = {0};
+    std::atomic<size_t> nhits = {0};
+
+    int lookup(const std::string &path, struct stat *st, bool follow);
+};
+
+struct mount_t {
+    std::string dir;
+    std::string source;
+    std::string type;
+};
+
+/*
+ * The mount table, read once the first time a mountpoint is looked up and
+ * indexed by device and, on Linux, by mount id. Autofs placeholders are
+ * left out since the filesystem mounted on top is the interesting one.
+ */
+class MountIndex
+{
+public:
+    MountIndex() = default;
+    virtual ~MountIndex() = default;
+
+    MountIndex(const MountIndex &) = delete;
+    MountIndex(MountIndex &&other) = delete;
+    MountIndex &operator=(const MountIndex &other) = delete;
+    MountIndex &operator=(MountIndex &&other) = delete;
+
+    /*
+     * The mount a directory with the given st_dev is the root of, or
+     * nullptr when it is not a mountpoint.
+     */
+    const mount_t *find(const std::string &path, dev_t dev);
+private:
+    std::once_flag loaded;
+    std::once_flag statted;
+
+    std::vector<mount_t> mounts;
+
+    std::unordered_map<uint64_t, size_t> ids;
+    std::unordered_map<dev_t, size_t> devs;
+    std::unordered_map<dev_t, size_t> statdevs;
+
+    void load();
+    void statmounts();
+};
+
+struct fscaps_t {
+    bool acl;
+};
+
+/*
+ * What each filesystem (by st_dev) can store, worked out from statfs() and
+ * one probe the first time a path on it is looked at, so ACL checks can be
+ * skipped where there cannot be any.
+ */
+class FsCaps
+{
+public:
+    FsCaps() = default;
+    virtual ~FsCaps() = default;
+
+    FsCaps(const FsCaps &) = delete;
+    FsCaps(FsCaps &&other) = delete;
+    FsCaps &operator=(const FsCaps &other) = delete;
+    FsCaps &operator=(FsCaps &&other) = delete;
+
+    fscaps_t get(dev_t dev, const std::string &path);
+private:
+    std::shared_mutex lock;
+    std::unordered_map<dev_t, fscaps_t> devs;
+
+    static fscaps_t probe(const std::string &path);
+};
+
+/*
+ * uid/gid to name lookups, shared by every thread for the whole run. Ids
+ * without a name map to their number.
+ */
+class IdCache
+{
+public:
+    IdCache() = default;
+    virtual ~IdCache() = default;
+
+    IdCache(const IdCache &) = delete;
+    IdCache(IdCache &&other) = delete;
+    IdCache &operator=(const IdCache &other) = delete;
+    IdCache &operator=(IdCache &&other) = delete;
+
+    std::string user(uid_t uid);
+    std::string group(gid_t gid);
+
+    /*
+     * Fills the cache from /etc/passwd and /etc/group in one go. Ids that
+     * only other NSS sources know about are still looked up on a miss.
+     */
+    void preload();
+private:
+    struct shard_t {
+        std::shared_mutex lock;
+        std::unordered_map<uint32_t, std::string> names;
+    };
+
+    std::array<shard_t, CACHE_SHARDS> users;
+    std::array<shard_t, CACHE_SHARDS> groups;
+
+    static bool find(shard_t *shard, uint32_t id, std::string *name);
+    static void store(shard_t *shard, uint32_t id, const std::string &name);
+    static void load(const char *file, std::array<shard_t, CACHE_SHARDS> *shards);
+};
+
+extern StatCache statcache;
+extern MountIndex mountindex;
+extern FsCaps fscaps;
+extern IdCache idcache;
+
+#endif // CACHE_HPP_
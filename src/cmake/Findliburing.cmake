@@ -0,0 +1,25 @@
+# Find liburing Library
+#
+#  LIBURING_INCLUDE_DIR  - Where to find liburing.h.
+#  LIBURING_LIBRARIES    - List of libraries when using liburing.
+#  LIBURING_FOUND        - True if liburing is found.
+
+find_path(LIBURING_INCLUDE_DIR NAMES liburing.h)
+find_library(LIBURING_LIBRARY NAMES uring)
+
+# handle the QUIETLY and REQUIRED arguments and set LIBURING_FOUND to TRUE if
+# all listed variables are TRUE
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(
+  liburing
+  REQUIRED_VARS LIBURING_LIBRARY LIBURING_INCLUDE_DIR
+)
+
+if (LIBURING_FOUND)
+  set(LIBURING_LIBRARIES    ${LIBURING_LIBRARY})
+endif()
+
+mark_as_advanced(
+  LIBURING_INCLUDE_DIR
+  LIBURING_LIBRARY
+)
@@ -0,0 +1,507 @@
+#include "dir.hpp"
+#include "entry.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    #ifdef __linux__
+        #include <sys/syscall.h>
+        #include <sys/sysmacros.h>
+    #endif
+
+    #ifdef USE_IO_URING
+        #include <liburing.h>
+    #endif
+}
+
+#define DIR_BUFSIZE_MIN (32 * 1024)
+#define DIR_BUFSIZE_MAX (4 * 1024 * 1024)
+#define DIR_BATCH_MAX 1024
+
+#ifdef STATX_TYPE
+static unsigned int statx_mask = STATX_BASIC_STATS;
+static int statx_flags = AT_SYMLINK_NOFOLLOW;
+static std::atomic<bool> statx_supported = {true};
+
+static void statxtostat(const struct statx &stx, struct stat *st)
+{
+    *st = {};
+
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_mode = stx.stx_mode;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_size = static_cast<off_t>(stx.stx_size);
+    st->st_blksize = static_cast<blksize_t>(stx.stx_blksize);
+    st->st_blocks = static_cast<blkcnt_t>(stx.stx_blocks);
+    st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+    st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+}
+#endif
+
+// bit per d_type value that can be listed without a stat
+static uint32_t dtype_only = 0;
+
+#if defined(USE_IO_URING) && defined(STATX_TYPE)
+#define URING_DEPTH 256
+// user_data of the cancel requests, never an index into a batch
+#define URING_CANCEL (~static_cast<uintptr_t>(0))
+
+class Ring
+{
+public:
+    Ring()
+    {
+        this->usable = (io_uring_queue_init(URING_DEPTH, &ring, 0) == 0);
+    }
+
+    virtual ~Ring()
+    {
+        if (usable) {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    Ring(const Ring &) = delete;
+    Ring(Ring &&other) = delete;
+    Ring &operator=(const Ring &other) = delete;
+    Ring &operator=(Ring &&other) = delete;
+
+    bool usable;
+    struct io_uring ring;
+};
+
+// statbatch() runs in the OpenMP tasks of listdir(), so one ring per worker
+static thread_local Ring uring;
+#endif
+
+DirReader::DirReader(const char *path) :
+    bufsize(DIR_BUFSIZE_MIN)
+{
+    #ifdef __linux__
+
+    this->dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC); // NOLINT
+
+    #else
+
+    this->dir = opendir(path);
+    this->dfd = (dir != nullptr) ? dirfd(dir) : -1;
+
+    #endif
+}
+
+DirReader::~DirReader()
+{
+    #ifdef __linux__
+
+    if (dfd >= 0) {
+        close(dfd);
+    }
+
+    #else
+
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+
+    #endif
+}
+
+bool DirReader::next(DirBatch *batch)
+{
+    batch->clear();
+
+    if (dfd < 0) {
+        return false;
+    }
+
+    #ifdef __linux__
+
+    std::unique_ptr<char[]> chunk(new char[bufsize]);
+
+    long nread = syscall(SYS_getdents64, dfd, chunk.get(), bufsize);
+
+    if (nread <= 0) {
+        return false;
+    }
+
+    for (long pos = 0; pos < nread;) {
+        // glibc's dirent64 has the same layout as the kernel record
+        // NOLINTNEXTLINE
+        auto *ent = reinterpret_cast<struct dirent64 *>(chunk.get() + pos);
+
+        batch->push_back({ &ent->d_name[0], ent->d_ino, ent->d_type });
+        pos += ent->d_reclen;
+    }
+
+    /*
+     * A read that used most of the buffer means the directory is larger
+     * than what we asked for, so ask for more next time.
+     */
+    if (static_cast<size_t>(nread) > bufsize / 2) {
+        bufsize = std::min<size_t>(bufsize * 2, DIR_BUFSIZE_MAX);
+    }
+
+    chunks.push_back(std::move(chunk));
+
+    #else
+
+    dirent *ent;
+
+    while (batch->size() < DIR_BATCH_MAX && (ent = readdir(dir)) != nullptr) {
+        names.emplace_back(&ent->d_name[0]);
+        batch->push_back({ names.back().c_str(), ent->d_ino, ent->d_type });
+    }
+
+    #endif
+
+    return !batch->empty();
+}
+
+void initstat()
+{
+    #ifdef STATX_TYPE
+    unsigned int mask = STATX_TYPE | STATX_MODE;
+    #endif
+
+    bool fullstat = false;
+    bool suffix = false;
+
+    for (size_t pos = 0; (pos = settings.format.find('@', pos)) != std::string::npos;) {
+        pos++;
+
+        if (pos < settings.format.length() && settings.format.at(pos) == '^') {
+            pos++;
+        }
+
+        if (pos >= settings.format.length()) {
+            break;
+        }
+
+        switch (settings.format.at(pos)) {
+            case 'u': case 'g': case 'U':
+                #ifdef STATX_TYPE
+                mask |= STATX_UID | STATX_GID;
+                #endif
+                fullstat = true;
+                break;
+
+            case 'r': case 't': case 'D': case 'T':
+                #ifdef STATX_TYPE
+                mask |= STATX_MTIME;
+                #endif
+                fullstat = true;
+                break;
+
+            case 's':
+                #ifdef STATX_TYPE
+                mask |= STATX_SIZE;
+                #endif
+                fullstat = true;
+                break;
+
+            case 'f': case 'F':
+                suffix = true;
+                break;
+
+            case 'G':
+                /*
+                 * What the index keeps of each file, so that the status
+                 * scan can reuse whatever the listing stat'ed.
+                 */
+                #if defined(STATX_TYPE) && defined(USE_GIT)
+                mask |= STATX_MTIME | STATX_CTIME | STATX_INO | STATX_UID |
+                        STATX_GID | STATX_SIZE;
+                #endif
+                break;
+
+            case '@':
+                break;
+
+            default:
+                fullstat = true;
+                break;
+        }
+    }
+
+    if ((settings.sort & (SORT_MODIFIED | SORT_SIZE)) != 0) {
+        fullstat = true;
+    }
+
+    #ifdef STATX_TYPE
+
+    if ((settings.sort & SORT_MODIFIED) == SORT_MODIFIED) {
+        mask |= STATX_MTIME;
+    }
+
+    if ((settings.sort & SORT_SIZE) == SORT_SIZE) {
+        mask |= STATX_SIZE;
+    }
+
+    if (settings.list && settings.resolve_mounts) {
+        mask |= STATX_INO;
+    }
+
+    statx_mask = mask;
+    statx_flags = AT_SYMLINK_NOFOLLOW;
+
+    if (settings.dont_sync) {
+        statx_flags |= AT_STATX_DONT_SYNC;
+    }
+
+    #endif
+
+    dtype_only = 0;
+
+    if (fullstat) {
+        return;
+    }
+
+    uint32_t types = (1u << DT_FIFO) | (1u << DT_CHR) | (1u << DT_BLK) |
+                     (1u << DT_SOCK);
+
+    if (!settings.resolve_links) {
+        types |= 1u << DT_LNK;
+    }
+
+    /*
+     * Like ls, only directories take the sticky and other-writable colours
+     * and only regular files the setuid and setgid ones, so each type is
+     * stat'ed just for the rules that can apply to it.
+     */
+    bool dirbits = settings.colors && (
+                       colors.count(SLK_STICKY) != 0 ||
+                       colors.count(SLK_OWT) != 0 ||
+                       colors.count(SLK_OWR) != 0
+                   );
+
+    if (!dirbits && !(settings.list && settings.resolve_mounts)) {
+        types |= 1u << DT_DIR;
+    }
+
+    bool filebits = settings.colors && (
+                        colors.count(SLK_SUID) != 0 ||
+                        colors.count(SLK_SGID) != 0
+                    );
+
+    // the exec bit is only needed for the exec suffix
+    if (!filebits && (!suffix || settings.symbols.suffix.exec.empty())) {
+        types |= 1u << DT_REG;
+    }
+
+    dtype_only = types;
+}
+
+bool needstat(unsigned char type)
+{
+    return type == DT_UNKNOWN || type >= 32 || (dtype_only & (1u << type)) == 0;
+}
+
+int statat(int dirfd, const char *name, struct stat *st)
+{
+    #ifdef STATX_TYPE
+
+    if (statx_supported) {
+        struct statx stx = {0};
+
+        if (statx(dirfd, name, statx_flags, statx_mask, &stx) == 0) {
+            statxtostat(stx, st);
+            return 0;
+        }
+
+        if (errno != ENOSYS) {
+            return -1;
+        }
+
+        statx_supported = false;
+    }
+
+    #endif
+
+    return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
+#if defined(USE_IO_URING) && defined(STATX_TYPE)
+// statat() with the errno of a failure returned negated
+static int statres(int dirfd, const char *name, struct stat *st)
+{
+    return (statat(dirfd, name, st) == 0) ? 0 : -errno;
+}
+
+/*
+ * Cancels the requests of a batch still pending in res and waits for all
+ * of them, as the kernel writes their results into the batch's buffers
+ * for as long as they are in flight. Returns false when the ring cannot
+ * even be waited on, in which case the buffers must never be freed.
+ */
+static bool drain(struct io_uring *ring, const int *res, size_t num)
+{
+    size_t inflight = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        if (res[i] != 1) {
+            continue;
+        }
+
+        inflight++;
+
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+        if (sqe != nullptr) {
+            // NOLINTNEXTLINE
+            io_uring_prep_cancel(sqe, reinterpret_cast<void *>(i), 0);
+            // NOLINTNEXTLINE
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(URING_CANCEL));
+        }
+    }
+
+    // a cancel that does not get through only makes the wait longer
+    io_uring_submit(ring);
+
+    while (inflight > 0) {
+        struct io_uring_cqe *cqe = nullptr;
+        int error = io_uring_wait_cqe(ring, &cqe);
+
+        if (error == -EINTR) {
+            continue;
+        }
+
+        if (error < 0) {
+            return false;
+        }
+
+        // NOLINTNEXTLINE
+        if (reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)) != URING_CANCEL) {
+            inflight--;
+        }
+
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+    return true;
+}
+#endif
+
+bool statbatch(int dirfd, const char *const *names, size_t count,
+               struct stat *st, int *res)
+{
+    #if defined(USE_IO_URING) && defined(STATX_TYPE)
+
+    if (!uring.usable || !statx_supported) {
+        return false;
+    }
+
+    std::unique_ptr<struct statx[]> stx(
+        new struct statx[std::min<size_t>(count, URING_DEPTH)]()
+    );
+
+    for (size_t base = 0; base < count; base += URING_DEPTH) {
+        size_t num = std::min<size_t>(URING_DEPTH, count - base);
+
+        for (size_t i = 0; i < num; i++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&uring.ring);
+
+            io_uring_prep_statx(
+                sqe,
+                dirfd,
+                names[base + i],
+                statx_flags,
+                statx_mask,
+                &stx[i]
+            );
+
+            // NOLINTNEXTLINE
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(i));
+
+            res[base + i] = 1; // pending
+        }
+
+        int submitted;
+
+        // an interrupted wait has already handed the batch to the kernel
+        while ((submitted = io_uring_submit_and_wait(&uring.ring, num)) == -EINTR) {
+        }
+
+        if (submitted < 0) {
+            uring.usable = false;
+
+            /*
+             * There is no telling which of the batch the kernel took, and
+             * waiting for requests it never got would not return.
+             */
+            stx.release(); // NOLINT the kernel may still write to it
+
+            for (size_t i = base; i < count; i++) {
+                res[i] = statres(dirfd, names[i], &st[i]);
+            }
+
+            return true;
+        }
+
+        for (size_t done = 0; done < num; done++) {
+            struct io_uring_cqe *cqe = nullptr;
+            int error;
+
+            while ((error = io_uring_wait_cqe(&uring.ring, &cqe)) == -EINTR) {
+            }
+
+            if (error < 0) {
+                uring.usable = false;
+
+                if (!drain(&uring.ring, &res[base], num)) {
+                    stx.release(); // NOLINT the kernel may still write to it
+                }
+
+                break;
+            }
+
+            // NOLINTNEXTLINE
+            auto i = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+            int result = cqe->res;
+
+            io_uring_cqe_seen(&uring.ring, cqe);
+
+            if (result == 0) {
+                statxtostat(stx[i], &st[base + i]);
+                res[base + i] = 0;
+            } else if (result == -EINVAL || result == -EOPNOTSUPP) {
+                // the kernel has io_uring but not IORING_OP_STATX
+                uring.usable = false;
+                res[base + i] = statres(dirfd, names[base + i], &st[base + i]);
+            } else {
+                res[base + i] = result;
+            }
+        }
+
+        if (!uring.usable) {
+            for (size_t i = base; i < count; i++) {
+                if (i >= base + num || res[i] == 1) {
+                    res[i] = statres(dirfd, names[i], &st[i]);
+                }
+            }
+
+            return true;
+        }
+    }
+
+    return true;
+
+    #else
+
+    return false;
+
+    #endif
+}
@@ -0,0 +1,89 @@
+// NOLINTNEXTLINE
+#ifndef DIR_HPP_
+#define DIR_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+}
+
+struct DirEntry {
+    const char *name;
+    uint64_t ino;
+    unsigned char type;
+};
+
+using DirBatch = std::vector<DirEntry>;
+
+/*
+ * Enumerates a directory in bulk. On Linux the entries are read with raw
+ * getdents64 into buffers that double in size while the directory keeps
+ * filling them, and DirEntry::name points straight into those buffers.
+ * Other platforms fall back to opendir/readdir.
+ *
+ * Names stay valid for the lifetime of the reader.
+ */
+class DirReader
+{
+public:
+    explicit DirReader(const char *path);
+    virtual ~DirReader();
+
+    DirReader(const DirReader &) = delete;
+    DirReader(DirReader &&other) = delete;
+    DirReader &operator=(const DirReader &other) = delete;
+    DirReader &operator=(DirReader &&other) = delete;
+
+    bool isopen() const { return dfd >= 0; }
+    int fd() const { return dfd; }
+
+    bool next(DirBatch *batch);
+private:
+    int dfd;
+    size_t bufsize;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+
+    #ifndef __linux__
+    DIR *dir;
+    std::deque<std::string> names;
+    #endif
+};
+
+/*
+ * Works out which stat fields the active format and sort order need, and
+ * which entry types can be listed from d_type alone. Must be called once
+ * the settings and LS_COLORS are final.
+ */
+void initstat();
+
+/*
+ * True unless the d_type of an entry is all the format and the colour
+ * rules need from it.
+ */
+bool needstat(unsigned char type);
+
+/*
+ * lstat relative to an open directory, asking the kernel only for the
+ * fields computed by initstat(). Fields that were not asked for may be zero.
+ */
+int statat(int dirfd, const char *name, struct stat *st);
+
+/*
+ * Stats count names relative to dirfd in one go, storing the result of
+ * each in res: 0, or the errno of the failure negated. With io_uring the
+ * requests are queued together and completed by the kernel as a batch.
+ * Returns false without touching anything when no batching backend is
+ * available, in which case the caller should stat entries itself.
+ */
+bool statbatch(int dirfd, const char *const *names, size_t count,
+               struct stat *st, int *res);
+
+#endif // DIR_HPP_
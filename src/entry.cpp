@@ -1,4 +1,5 @@
 #include "entry.hpp"
+#include "cache.hpp"
 
 #include <absl/strings/string_view.h>
 #include <algorithm>
@@ -15,9 +16,7 @@
 
 extern "C" {
     #include <dirent.h>
-    #include <grp.h>
     #include <libgen.h>
-    #include <pwd.h>
     #include <sys/stat.h>
     #include <sys/statvfs.h>
     #include <sys/xattr.h>
@@ -27,14 +26,9 @@ extern "C" {
 
     #ifdef __linux__
         #include <linux/xattr.h>
-        #include <mntent.h>
     #elif __APPLE__
         #include <sys/types.h>
         #include <sys/acl.h>
-
-        #include <sys/param.h>
-        #include <sys/ucred.h>
-        #include <sys/mount.h>
     #endif
 
     #ifdef USE_GIT
@@ -44,8 +38,6 @@ extern "C" {
 
 std::unordered_map<std::string, std::string> colors;
 
-std::unordered_map<uint8_t, std::string> uid_cache;
-std::unordered_map<uint8_t, std::string> gid_cache;
 
 std::string Entry::colorize(const std::string &input, color_t color)
 {
@@ -87,88 +79,37 @@ uint32_t Entry::cleanlen(std::string input)
     return input.length();
 }
 
-std::string Entry::isMountpoint(char *fullpath, const struct stat *st)
+std::string Entry::isMountpoint()
 {
     if (settings.resolve_mounts && settings.list) {
         struct stat parent = {0};
         struct stat target = {0};
 
-        #ifdef __linux__
-        struct stat check = {0};
-        struct mntent *mnt = nullptr;
-        #endif
-
-        char *ppath = dirname(fullpath);
-
-        if (stat(ppath, &parent) == 0) {
-            if (st->st_dev != parent.st_dev || st->st_ino == parent.st_ino) {
-                #ifdef __linux__
-
-                FILE *fp = setmntent("/proc/mounts", "r");
-
-                if (fp != nullptr) {
-                    while ((mnt = getmntent(fp)) != nullptr) {
-                        if (stat(mnt->mnt_dir, &check) != 0) {
-                            continue;
-                        }
-
-                        if (
-                            check.st_dev == st->st_dev &&
-                            strcmp(mnt->mnt_type, "autofs") != 0
-                        ) {
-                            endmntent(fp);
-
-                            this->islink = true;
-                            this->target = mnt->mnt_fsname;
-
-                            if (stat(mnt->mnt_fsname, &target) == 0) {
-                                this->target_color = getColor(
-                                                         mnt->mnt_fsname,
-                                                         target.st_mode
-                                                     );
-                            } else {
-                                this->target_color = findColor(SLK_CHR);
-                            }
-
-                            return colorize(
-                                       settings.symbols.suffix.mountpoint,
-                                       settings.color.suffix.mountpoint
-                                   );
-                        }
-                    }
-                }
+        std::string dir = fullpath;
+        char *ppath = dirname(&dir[0]);
+
+        if (statcache.stat(ppath, &parent) == 0) {
+            if (dev != parent.st_dev || ino == parent.st_ino) {
+                const mount_t *mnt = mountindex.find(fullpath, dev);
+
+                if (mnt != nullptr) {
+                    this->islink = true;
+                    this->target = mnt->source;
 
-                endmntent(fp);
-
-                #elif __APPLE__
-
-                struct statfs *mounts;
-                int num = getmntinfo(&mounts, MNT_WAIT);
-
-                if (num != 0) {
-                    for (int i = 0; i < num; i++) {
-                        if (st->st_dev == mounts[i].f_fsid.val[0]) {
-                            this->islink = true;
-                            this->target = mounts[i].f_mntfromname;
-
-                            if (stat(mounts[i].f_mntfromname, &target) == 0) {
-                                this->target_color = getColor(
-                                                         mounts[i].f_mntfromname,
-                                                         target.st_mode
-                                                     );
-                            } else {
-                                this->target_color = findColor(SLK_CHR);
-                            }
-
-                            return colorize(
-                                       settings.symbols.suffix.mountpoint,
-                                       settings.color.suffix.mountpoint
-                                   );
-                        }
+                    if (statcache.stat(mnt->source, &target) == 0) {
+                        this->target_color = getColor(
+                                                 mnt->source,
+                                                 target.st_mode
+                                             );
+                    } else {
+                        this->target_color = findColor(SLK_CHR);
                     }
-                }
 
-                #endif
+                    return colorize(
+                               settings.symbols.suffix.mountpoint,
+                               settings.color.suffix.mountpoint
+                           );
+                }
             }
         }
     }
@@ -186,11 +127,14 @@ Entry::Entry(
     unsigned int flags
 ) :
     file(file),
+    fullpath(fullpath),
     git(1, ' '), // NOLINT
     suffix(1, ' ') // NOLINT
 {
     this->islink = false;
     this->totlen = 0;
+    this->flags = flags;
+    this->resolved = 0;
 
     if (st == nullptr) {
         this->user = colorize("????", settings.color.user.user); // NOLINT
@@ -199,222 +143,237 @@ Entry::Entry(
         this->isdir = false;
         this->modified = 0;
         this->bsize = 0;
+        this->uid = 0;
+        this->gid = 0;
+        this->dev = 0;
+        this->ino = 0;
 
         this->color = findColor(SLK_ORPHAN);
+        this->resolved = RESOLVED_OWNER | RESOLVED_TARGET | RESOLVED_GIT;
     } else {
         this->color = getColor(file, st->st_mode);
 
-        #ifdef USE_GIT
+        this->modified = st->st_mtime;
+        this->bsize = st->st_size;
+        this->mode = st->st_mode;
+        this->uid = st->st_uid;
+        this->gid = st->st_gid;
+        this->dev = st->st_dev;
+        this->ino = st->st_ino;
 
-        if (flags != NO_FLAGS && (settings.resolve_repos || settings.resolve_in_repos)) {
-            std::string symbol;
-            color_t color = {0};
+        this->isdir = S_ISDIR(st->st_mode); // NOLINT
+    }
 
-            if (S_ISDIR(st->st_mode)) { // NOLINT
-                if ((flags & GIT_ISREPO) != 0) {
-                    if ((flags & GIT_DIR_DIRTY) != 0) {
-                        color = settings.color.git.repo_dirty;
-                        symbol = settings.symbols.git.repo_dirty;
-                    } else if ((flags & GIT_DIR_BARE) != 0) {
-                        color = settings.color.git.repo_bare;
-                        symbol = settings.symbols.git.repo_bare;
-                    } else {
-                        color = settings.color.git.repo_clean;
-                        symbol = settings.symbols.git.repo_clean;
-                    }
+    if (isdir){
+        extension = "directory";
+    } else {
+        std::string::size_type idx = file.rfind('.');
 
-                    if (settings.override_git_repo_color) {
-                        this->color = colorize(symbol, color);
-                    } else {
-                        this->git = colorize(symbol, color);
-                    }
-                } else {
-                    if ((flags & GIT_DIR_DIRTY) != 0) {
-                        color = settings.color.git.dir_dirty;
-                        symbol = settings.symbols.git.dir_dirty;
-                    } else if ((flags & GIT_STATUS_IGNORED) != 0) {
-                        color = settings.color.git.ignore;
-                        symbol = settings.symbols.git.ignore;
-                    } else if ((flags & GIT_ISTRACKED) != 0) {
-                        color = settings.color.git.dir_clean;
-                        symbol = settings.symbols.git.dir_clean;
-                    } else {
-                        color = settings.color.git.untracked;
-                        symbol = settings.symbols.git.untracked;
-                    }
+        if (idx != std::string::npos) {
+            extension = file.substr(idx + 1);
+        } else {
+            extension = "unknown";
+        }
+    }
 
-                    if (settings.override_git_dir_color) {
-                        this->color = colorize(symbol + file, color);
-                    } else {
-                        this->git = colorize(symbol, color);
-                    }
-                }
-            } else {
-                if ((flags & GIT_STATUS_IGNORED) != 0) {
-                    color = settings.color.git.ignore;
-                    symbol = settings.symbols.git.ignore;
-                } else if ((flags & GIT_STATUS_CONFLICTED) != 0) {
-                    color = settings.color.git.conflict;
-                    symbol = settings.symbols.git.conflict;
-                } else if ((flags & GIT_STATUS_WT_MODIFIED) != 0) {
-                    color = settings.color.git.modified;
-                    symbol = settings.symbols.git.modified;
-                } else if ((flags & GIT_STATUS_WT_RENAMED) != 0) {
-                    color = settings.color.git.renamed;
-                    symbol = settings.symbols.git.renamed;
-                } else if ((flags & GIT_STATUS_INDEX_NEW) != 0) {
-                    color = settings.color.git.added;
-                    symbol = settings.symbols.git.added;
-                } else if ((flags & GIT_STATUS_WT_TYPECHANGE) != 0) {
-                    color = settings.color.git.typechange;
-                    symbol = settings.symbols.git.typechange;
-                } else if ((flags & GIT_STATUS_WT_UNREADABLE) != 0) {
-                    color = settings.color.git.unreadable;
-                    symbol = settings.symbols.git.unreadable;
-                } else if ((flags & GIT_ISTRACKED) != 0) {
-                    color = settings.color.git.unchanged;
-                    symbol = settings.symbols.git.unchanged;
-                } else {
-                    color = settings.color.git.untracked;
-                    symbol = settings.symbols.git.untracked;
-                }
+    if (settings.colors) {
+        this->file += "\033[0m";
+    }
+}
 
-                this->git = colorize(symbol, color);
-            }
-        }
+void Entry::setflags(unsigned int flags)
+{
+    this->flags = flags;
+}
 
-        #endif
+void Entry::addflags(unsigned int flags)
+{
+    this->flags |= flags;
+}
 
-        this->target = "";
+void Entry::resolveGit()
+{
+    if ((resolved & RESOLVED_GIT) != 0) {
+        return;
+    }
 
-        #ifdef S_ISLNK
+    resolved |= RESOLVED_GIT;
 
-        if (S_ISLNK(st->st_mode) && !settings.resolve_links) { // NOLINT
-            char target[PATH_MAX] = {0};
+    #ifdef USE_GIT
 
-            if ((readlink(fullpath, &target[0], sizeof(target))) >= 0) {
-                if (settings.list) {
-                    this->suffix = colorize(
-                                       settings.symbols.suffix.link,
-                                       settings.color.suffix.link
-                                   );
-                }
+    if (flags == NO_FLAGS || !(settings.resolve_repos || settings.resolve_in_repos)) {
+        return;
+    }
 
-                this->islink = true;
+    std::string symbol;
+    color_t color = {0};
 
-                this->target = &target[0];
-                std::string fpath = &target[0]; // NOLINT
+    // the scan was given up on, nothing is known either way
+    if ((flags & GIT_UNKNOWN) != 0) {
+        this->git = colorize(settings.symbols.git.unknown, settings.color.git.unknown);
+        return;
+    }
 
-                if (target[0] != '/') {
-                    // NOLINTNEXTLINE
-                    fpath = std::string(dirname(fullpath)) + "/" + this->target;
-                }
+    if (S_ISDIR(mode)) { // NOLINT
+        if ((flags & GIT_ISREPO) != 0) {
+            if ((flags & GIT_DIR_DIRTY) != 0) {
+                color = settings.color.git.repo_dirty;
+                symbol = settings.symbols.git.repo_dirty;
+            } else if ((flags & GIT_DIR_BARE) != 0) {
+                color = settings.color.git.repo_bare;
+                symbol = settings.symbols.git.repo_bare;
+            } else {
+                color = settings.color.git.repo_clean;
+                symbol = settings.symbols.git.repo_clean;
+            }
 
-                struct stat tst = {0};
+            if (settings.override_git_repo_color) {
+                this->color = colorize(symbol, color);
+            } else {
+                this->git = colorize(symbol, color);
+            }
+        } else {
+            if ((flags & GIT_DIR_DIRTY) != 0) {
+                color = settings.color.git.dir_dirty;
+                symbol = settings.symbols.git.dir_dirty;
+            } else if ((flags & GIT_STATUS_IGNORED) != 0) {
+                color = settings.color.git.ignore;
+                symbol = settings.symbols.git.ignore;
+            } else if ((flags & GIT_ISTRACKED) != 0) {
+                color = settings.color.git.dir_clean;
+                symbol = settings.symbols.git.dir_clean;
+            } else {
+                color = settings.color.git.untracked;
+                symbol = settings.symbols.git.untracked;
+            }
 
-                if ((lstat(fpath.c_str(), &tst)) < 0) {
-                    this->color = findColor(SLK_ORPHAN);
-                    this->target_color = findColor(SLK_MISSING);
-                } else {
-                    this->color = getColor(file, tst.st_mode);
-                    this->target_color = getColor(&target[0], tst.st_mode);
-                }
+            if (settings.override_git_dir_color) {
+                this->color = colorize(symbol + file, color);
+            } else {
+                this->git = colorize(symbol, color);
             }
         }
+    } else {
+        if ((flags & GIT_STATUS_IGNORED) != 0) {
+            color = settings.color.git.ignore;
+            symbol = settings.symbols.git.ignore;
+        } else if ((flags & GIT_STATUS_CONFLICTED) != 0) {
+            color = settings.color.git.conflict;
+            symbol = settings.symbols.git.conflict;
+        } else if ((flags & GIT_STATUS_WT_MODIFIED) != 0) {
+            color = settings.color.git.modified;
+            symbol = settings.symbols.git.modified;
+        } else if ((flags & GIT_STATUS_WT_RENAMED) != 0) {
+            color = settings.color.git.renamed;
+            symbol = settings.symbols.git.renamed;
+        } else if ((flags & GIT_STATUS_INDEX_NEW) != 0) {
+            color = settings.color.git.added;
+            symbol = settings.symbols.git.added;
+        } else if ((flags & GIT_STATUS_WT_TYPECHANGE) != 0) {
+            color = settings.color.git.typechange;
+            symbol = settings.symbols.git.typechange;
+        } else if ((flags & GIT_STATUS_WT_UNREADABLE) != 0) {
+            color = settings.color.git.unreadable;
+            symbol = settings.symbols.git.unreadable;
+        } else if ((flags & GIT_ISTRACKED) != 0) {
+            color = settings.color.git.unchanged;
+            symbol = settings.symbols.git.unchanged;
+        } else {
+            color = settings.color.git.untracked;
+            symbol = settings.symbols.git.untracked;
+        }
 
-        #endif /* S_ISLNK */
+        this->git = colorize(symbol, color);
+    }
 
-        char buf[PATH_MAX] = {0};
+    #endif
+}
 
-        auto cuid = uid_cache.find(st->st_uid);
-        auto cgid = gid_cache.find(st->st_gid);
+void Entry::resolveFile()
+{
+    resolveTarget();
 
-        if (cuid == uid_cache.end()) {
-            struct passwd pw = { nullptr };
-            struct passwd *pwp;
-            if(settings.numeric_id) {
-                char uidbuf[PATH_MAX]={0};
-                stbsp_snprintf(uidbuf,PATH_MAX,"%i",st->st_uid);
-                this->user=colorize(uidbuf,settings.color.user.user);
-            } else {
-                getpwuid_r(st->st_uid, &pw, &buf[0], sizeof(buf), &pwp);
-                if (strlen(pw.pw_name) == 0) {
-                    char uidbuf[PATH_MAX]={0};
-                    stbsp_snprintf(uidbuf,PATH_MAX,"%i",st->st_uid);
-                    // NOLINTNEXTLINE
-                    this->user = colorize(uidbuf,settings.color.user.user);
-                } else {
-                    // NOLINTNEXTLINE
-                    this->user = colorize(pw.pw_name, settings.color.user.user);
-                }
-            }
+    // the git overrides replace the colour of the name
+    #ifdef USE_GIT
 
+    if (isdir && (settings.override_git_repo_color || settings.override_git_dir_color)) {
+        resolveGit();
+    }
 
-            uid_cache[st->st_uid] = this->user;
-        } else {
-            this->user = cuid->second;
-        }
+    #endif
+}
 
-        if (cgid == gid_cache.end()) {
-            struct group gr = { nullptr };
-            struct group *grp;
-            if(settings.numeric_id) {
-                char gidbuf[PATH_MAX]={0};
-                stbsp_snprintf(gidbuf,PATH_MAX,"%i",st->st_gid);
-                this->group=colorize(gidbuf,settings.color.user.group);
-            } else {
-                getgrgid_r(st->st_gid, &gr, &buf[0], sizeof(buf), &grp);
-                if (strlen(gr.gr_name) == 0) {
-                    char gidbuf[PATH_MAX]={0};
-                    stbsp_snprintf(gidbuf,PATH_MAX,"%i",st->st_gid);
-                    // NOLINTNEXTLINE
-                    this->group = colorize(gidbuf,settings.color.user.group);
-                } else {
-                    // NOLINTNEXTLINE
-                    this->group = colorize(gr.gr_name, settings.color.user.group);
-                }
+void Entry::resolveTarget()
+{
+    if ((resolved & RESOLVED_TARGET) != 0) {
+        return;
+    }
+
+    resolved |= RESOLVED_TARGET;
+
+    #ifdef S_ISLNK
+
+    if (S_ISLNK(mode) && !settings.resolve_links) { // NOLINT
+        char target[PATH_MAX] = {0};
+
+        if ((readlink(fullpath.c_str(), &target[0], sizeof(target) - 1)) >= 0) {
+            if (settings.list) {
+                this->suffix = colorize(
+                                   settings.symbols.suffix.link,
+                                   settings.color.suffix.link
+                               );
             }
 
-            gid_cache[st->st_gid] = this->group;
-        } else {
-            this->group = cgid->second;
-        }
+            this->islink = true;
 
-        this->modified = st->st_mtime;
-        this->bsize = st->st_size;
-        this->mode = st->st_mode;
-        this->fullpath = fullpath;
+            this->target = &target[0];
+            std::string fpath = &target[0]; // NOLINT
 
-        this->isdir = false;
+            if (target[0] != '/') {
+                std::string dir = fullpath;
+                // NOLINTNEXTLINE
+                fpath = std::string(dirname(&dir[0])) + "/" + this->target;
+            }
 
-        if (S_ISDIR(st->st_mode)) { // NOLINT
-            this->isdir = true;
-            this->suffix = isMountpoint(fullpath, st);
-        } else if ((st->st_mode & S_IEXEC) != 0 && !islink) { // NOLINT
-            this->suffix = colorize(
-                               settings.symbols.suffix.exec,
-                               settings.color.suffix.exec
-                           );
+            struct stat tst = {0};
+
+            if ((statcache.lstat(fpath, &tst)) < 0) {
+                this->color = findColor(SLK_ORPHAN);
+                this->target_color = findColor(SLK_MISSING);
+            } else {
+                this->color = getColor(file, tst.st_mode);
+                this->target_color = getColor(&target[0], tst.st_mode);
+            }
         }
     }
 
-    if (isdir){
-        extension = "directory";
-    } else {
-        std::string::size_type idx = file.rfind('.');
+    #endif /* S_ISLNK */
 
-        if (idx != std::string::npos) {
-            extension = file.substr(idx + 1);
-        } else {
-            extension = "unknown";
-        }
+    if (isdir) {
+        this->suffix = isMountpoint();
+    } else if ((mode & S_IEXEC) != 0 && !islink) { // NOLINT
+        this->suffix = colorize(
+                           settings.symbols.suffix.exec,
+                           settings.color.suffix.exec
+                       );
     }
+}
 
-    if (settings.colors) {
-        this->file += "\033[0m";
+void Entry::resolveOwner()
+{
+    if ((resolved & RESOLVED_OWNER) != 0) {
+        return;
     }
 
-    postprocess();
+    resolved |= RESOLVED_OWNER;
+
+    if (settings.numeric_id) {
+        this->user = colorize(std::to_string(uid), settings.color.user.user);
+        this->group = colorize(std::to_string(gid), settings.color.user.group);
+    } else {
+        this->user = colorize(idcache.user(uid), settings.color.user.user);
+        this->group = colorize(idcache.group(gid), settings.color.user.group);
+    }
 }
 
 std::string Entry::colorperms(const std::string &input)
@@ -508,16 +467,19 @@ Segment Entry::format(char c)
         }
 
         case 'u': {
+            resolveOwner();
             output.first = user;
             break;
         }
 
         case 'g': {
+            resolveOwner();
             output.first = group;
             break;
         }
 
         case 'U': {
+            resolveOwner();
             output.first = user + colorize(
                                settings.symbols.user.separator,
                                settings.color.user.separator
@@ -553,6 +515,7 @@ Segment Entry::format(char c)
         case 'G': {
             if (settings.resolve_repos || settings.resolve_in_repos) {
                 #ifdef USE_GIT
+                    resolveGit();
                     output.first = git;
                 #else
                     output.first = "";
@@ -562,11 +525,13 @@ Segment Entry::format(char c)
         }
 
         case 'f': {
+            resolveFile();
             output.first += color + file + suffix + target_color + target;
             break;
         }
 
         case 'F': {
+            resolveFile();
             output.first += color + file + suffix;
             break;
         }
@@ -689,20 +654,37 @@ std::string Entry::findColor(const std::string &file)
 
 std::string Entry::getColor(const std::string &file, uint32_t mode)
 {
-    if ((mode & S_ISUID) != 0) { // NOLINT
-        return findColor(SLK_SUID);
-    }
-
-    if ((mode & S_ISGID) != 0) { // NOLINT
-        return findColor(SLK_SGID);
-    }
+    /*
+     * Like ls, the special bits only count when LS_COLORS has a rule for
+     * them, setuid and setgid on regular files, the sticky bit on
+     * directories. initstat() relies on this to skip stats.
+     */
+    if (S_ISREG(mode)) { // NOLINT
+        if ((mode & S_ISUID) != 0 && colors.count(SLK_SUID) != 0) { // NOLINT
+            return findColor(SLK_SUID);
+        }
 
-    if ((mode & S_ISVTX) != 0) { // NOLINT
-        return findColor((mode & S_IWOTH) ? SLK_OWT : SLK_STICKY); // NOLINT
+        if ((mode & S_ISGID) != 0 && colors.count(SLK_SGID) != 0) { // NOLINT
+            return findColor(SLK_SGID);
+        }
     }
 
     if (S_ISDIR(mode)) { // NOLINT
-        return findColor((mode & S_IWOTH) ? SLK_OWR : SLK_DIR); // NOLINT
+        if ((mode & S_ISVTX) != 0) { // NOLINT
+            if ((mode & S_IWOTH) != 0 && colors.count(SLK_OWT) != 0) { // NOLINT
+                return findColor(SLK_OWT);
+            }
+
+            if (colors.count(SLK_STICKY) != 0) {
+                return findColor(SLK_STICKY);
+            }
+        }
+
+        if ((mode & S_IWOTH) != 0 && colors.count(SLK_OWR) != 0) { // NOLINT
+            return findColor(SLK_OWR);
+        }
+
+        return findColor(SLK_DIR);
     }
 
     if (S_ISBLK(mode)) { // NOLINT
@@ -813,6 +795,33 @@ char Entry::fileHasAcl()
 
     #ifdef __linux__
 
+    if (!fscaps.get(dev, fullpath).acl) {
+        return ' ';
+    }
+
+    if (S_ISDIR(mode)) { // NOLINT
+        // one listxattr answers for both the access and the default ACL
+        char names[1024] = {0};
+        ssize_t len = listxattr(fullpath.c_str(), &names[0], sizeof(names));
+
+        if (len >= 0) {
+            for (ssize_t pos = 0; pos < len; pos += strlen(&names[pos]) + 1) {
+                if (
+                    strcmp(&names[pos], XATTR_NAME_POSIX_ACL_ACCESS) == 0 ||
+                    strcmp(&names[pos], XATTR_NAME_POSIX_ACL_DEFAULT) == 0
+                ) {
+                    return '+';
+                }
+            }
+
+            return ' ';
+        }
+
+        if (errno != ERANGE) {
+            return ' ';
+        }
+    }
+
     ssize_t xattr = getxattr(
                 fullpath.c_str(),
                 XATTR_NAME_POSIX_ACL_ACCESS,
@@ -1016,7 +1025,8 @@ DateFormat Entry::toDateFormat(const std::string &num, int unit)
 DateFormat Entry::isoTime(time_t ftime)
 {
     DateFormat output;
-    auto tm = std::localtime(&ftime);
+    struct tm tmbuf = {0};
+    auto tm = localtime_r(&ftime, &tmbuf);
 
     output.first = colorize(
         fmt("%d-%02d-%02d", tm->tm_year + 1900, tm->tm_mon, tm->tm_mday),
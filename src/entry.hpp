@@ -13,6 +13,8 @@
 #include <vector>
 #include <vector>
 
+#include "cache.hpp"
+
 extern "C" {
 #include <iniparser/iniparser.h>
 #include <sys/stat.h>
@@ -49,9 +51,14 @@ extern "C" {
 #define GIT_DIR_BARE  4
 #define GIT_ISREPO    8
 #define GIT_ISTRACKED 16
+#define GIT_UNKNOWN   32
 
 #define NO_FLAGS ~0u
 
+#define RESOLVED_OWNER  1
+#define RESOLVED_TARGET 2
+#define RESOLVED_GIT    4
+
 using DateFormat = std::pair<std::string, std::string>;
 
 using Segment = std::pair<std::string, int>;
@@ -91,6 +98,9 @@ struct settings_t { // NOLINT
     bool size_number_color;
     bool date_number_color;
     bool numeric_id;
+    bool dont_sync;
+    bool preload_ids;
+    bool cache_stats;
 
     std::string format;
     std::string list_format;
@@ -98,6 +108,10 @@ struct settings_t { // NOLINT
     #ifdef USE_GIT
     bool override_git_repo_color;
     bool override_git_dir_color;
+    bool git_update_index;
+    bool git_cache;
+    int git_jobs;
+    int git_timeout;
     #endif
 
     bool no_conf;
@@ -175,6 +189,7 @@ struct settings_t { // NOLINT
             color_t unreadable;
             color_t untracked;
             color_t unchanged;
+            color_t unknown;
 
             color_t dir_dirty;
             color_t dir_clean;
@@ -235,6 +250,7 @@ struct settings_t { // NOLINT
             std::string unreadable;
             std::string untracked;
             std::string unchanged;
+            std::string unknown;
 
             std::string dir_dirty;
             std::string dir_clean;
@@ -280,10 +296,32 @@ public:
 
     std::string print(Lengths maxlens, int *outlen);
 
+    // git flags that were only known after the entry was built
+    void setflags(unsigned int flags);
+    void addflags(unsigned int flags);
+
+    /*
+     * Formats the segments of the entry, once everything it depends on
+     * has been filled in. Must be called before print().
+     */
+    void postprocess();
+
     OutputFormat processed;
 private:
     std::string fullpath;
 
+    uid_t uid;
+    gid_t gid;
+    dev_t dev;
+    ino_t ino;
+    unsigned int flags;
+
+    /*
+     * Fields below are filled in on demand by the resolve* functions,
+     * only for the segments the format actually shows.
+     */
+    unsigned int resolved;
+
     std::string user;
     std::string group;
     std::string git;
@@ -302,7 +340,7 @@ private:
     static uint32_t cleanlen(std::string input);
     Segment format(char c);
 
-    std::string isMountpoint(char *fullpath, const struct stat *st);
+    std::string isMountpoint();
     std::string unitConv(float size);
     std::string findColor(const std::string &file);
     std::string getColor(const std::string &file, uint32_t mode);
@@ -311,7 +349,10 @@ private:
 
     char fileHasAcl();
 
-    void postprocess();
+    void resolveOwner();
+    void resolveTarget();
+    void resolveGit();
+    void resolveFile();
 };
 
 static inline const char *cpp11_getstring(dictionary *d, const char *key,
@@ -322,8 +363,7 @@ static inline const char *cpp11_getstring(dictionary *d, const char *key,
 
 static inline bool exists(const char *name)
 {
-    struct stat buffer = { 0 };
-    return (stat(name, &buffer) == 0);
+    return statcache.exists(name);
 }
 
 static inline std::string rtrim(const std::string &s)
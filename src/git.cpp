@@ -0,0 +1,389 @@
+#include "git.hpp"
+#include "cache.hpp"
+#include "entry.hpp"
+#include "pool.hpp"
+
+#ifdef USE_GIT
+
+StatusCache gitstatus;
+RepoFinder repofinder;
+
+#define GIT_STATUS_WT_CHANGED ( \
+    GIT_STATUS_WT_MODIFIED | \
+    GIT_STATUS_WT_DELETED | \
+    GIT_STATUS_WT_TYPECHANGE | \
+    GIT_STATUS_WT_RENAMED | \
+    GIT_STATUS_WT_UNREADABLE \
+)
+
+void scanstatus(git_repository *repo, const std::vector<std::string> &pathspecs,
+                std::vector<status_t> *out)
+{
+    git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+
+    opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+    // ignored paths are left to GitIgnore, which libgit2 then need not check
+    opts.flags = (
+                     GIT_STATUS_OPT_INCLUDE_UNMODIFIED |
+                     GIT_STATUS_OPT_EXCLUDE_SUBMODULES |
+                     GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH
+                 );
+
+    /*
+     * Left alone the scan never takes index.lock: entries whose stat data
+     * disagrees with the index (racily clean ones included) are hashed and
+     * compared by content instead, for this run only.
+     */
+    if (settings.git_update_index) {
+        opts.flags |= GIT_STATUS_OPT_UPDATE_INDEX;
+    }
+
+    /*
+     * A literal pathspec also matches everything below it and lets libgit2
+     * walk just that part of the index and the work tree.
+     */
+    std::vector<char *> strings;
+
+    for (const auto &p : pathspecs) {
+        if (p.empty()) {
+            strings.clear();
+            break;
+        }
+
+        strings.push_back(const_cast<char *>(p.c_str())); // NOLINT
+    }
+
+    opts.pathspec.count = strings.size();
+    opts.pathspec.strings = strings.data();
+
+    git_status_list *list = nullptr;
+
+    if (git_status_list_new(&list, repo, &opts) != GIT_OK) {
+        return;
+    }
+
+    size_t iMax = git_status_list_entrycount(list);
+
+    out->reserve(out->size() + iMax);
+
+    for (size_t i = 0; i < iMax; ++i) {
+        const git_status_entry *status = git_status_byindex(list, i);
+        const char *filePath = (status->head_to_index != nullptr) ?
+                               status->head_to_index->new_file.path :
+                               (status->index_to_workdir != nullptr) ?
+                               status->index_to_workdir->new_file.path :
+                               nullptr;
+
+        if (filePath == nullptr) {
+            continue;
+        }
+
+        std::string path = filePath;
+        unsigned int below = 0;
+
+        // only what is in the index makes a directory tracked or dirty
+        if (status->index_to_workdir != nullptr) {
+            below = GIT_ISTRACKED;
+
+            if ((status->status & GIT_STATUS_WT_CHANGED) != 0) {
+                below |= GIT_DIR_DIRTY;
+            }
+        }
+
+        unsigned int bits = status->status;
+
+        out->push_back({path, bits | GIT_ISTRACKED, below});
+    }
+
+    git_status_list_free(list);
+}
+
+RepoStatus::RepoStatus(git_repository *repo, const std::string &scope,
+                       const StatHints *hints) :
+    nodes(1, node_t {0, 0, {}})
+{
+    std::vector<status_t> entries;
+    bool scanned = settings.git_cache && cachedstatus(repo, scope, &entries);
+
+    if (!scanned) {
+        entries.clear();
+        scanned = indexstatus(repo, scope, hints, &entries);
+    }
+
+    if (!scanned) {
+        entries.clear();
+        scanstatus(repo, {scope}, &entries);
+    }
+
+    for (const auto &e : entries) {
+        insert(e.path, e.bits, e.below);
+    }
+
+    submodules(repo, scope);
+
+    ignores = std::make_unique<const GitIgnore>(repo);
+}
+
+/*
+ * The scans above leave submodules out. Each one below scope is tracked,
+ * and dirty when its HEAD is not the commit recorded in the index or when
+ * its own work tree is. They are opened and scanned as one group on
+ * gitpool, which this scan helps run, so nested submodules neither wait
+ * on busy workers nor start threads of their own.
+ */
+void RepoStatus::submodules(git_repository *repo, const std::string &scope)
+{
+    const char *wd = git_repository_workdir(repo);
+    git_index *index = nullptr;
+
+    // reading the index is not worth it for the many repositories without any
+    if (wd == nullptr || !statcache.exists(std::string(wd) + ".gitmodules") ||
+        git_repository_index(&index, repo) != GIT_OK) {
+        return;
+    }
+
+    std::vector<std::pair<std::string, git_oid>> found;
+    std::string prefix = scope.empty() ? "" : scope + "/";
+    size_t iMax = git_index_entrycount(index);
+
+    for (size_t i = 0; i < iMax; ++i) {
+        const git_index_entry *e = git_index_get_byindex(index, i);
+
+        if (e->mode == GIT_FILEMODE_COMMIT &&
+            (scope.empty() || scope == e->path ||
+             strncmp(e->path, prefix.c_str(), prefix.length()) == 0)) {
+            found.emplace_back(e->path, e->id);
+        }
+    }
+
+    git_index_free(index);
+
+    std::string workdir = wd;
+    std::vector<unsigned int> below(found.size(), GIT_ISTRACKED);
+
+    std::vector<std::function<void()>> probes;
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        probes.emplace_back([&, i]() {
+            git_repository *sub = nullptr;
+
+            // not checked out, nothing to compare against
+            if (git_repository_open_ext(
+                    &sub, (workdir + found[i].first).c_str(),
+                    GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr) != GIT_OK) {
+                return;
+            }
+
+            git_oid head;
+
+            if (git_reference_name_to_id(&head, sub, "HEAD") != GIT_OK ||
+                git_oid_cmp(&head, &found[i].second) != 0 ||
+                (gitstatus.get(sub, "")->dir("") & GIT_DIR_DIRTY) != 0) {
+                below[i] |= GIT_DIR_DIRTY;
+            }
+
+            git_repository_free(sub);
+        });
+    }
+
+    gitpool.run(probes);
+
+    for (size_t i = 0; i < found.size(); ++i) {
+        insert(found[i].first, GIT_ISTRACKED, below[i]);
+    }
+}
+
+RepoStatus::RepoStatus() :
+    nodes(1, node_t {GIT_UNKNOWN, GIT_UNKNOWN, {}}), missing(GIT_UNKNOWN)
+{
+}
+
+const RepoStatus &RepoStatus::unknown()
+{
+    static const RepoStatus status;
+    return status;
+}
+
+void RepoStatus::insert(const std::string &path, unsigned int bits,
+                        unsigned int below)
+{
+    size_t node = 0;
+    size_t start = 0;
+
+    while (start < path.length()) {
+        size_t end = path.find('/', start);
+
+        if (end == std::string::npos) {
+            end = path.length();
+        }
+
+        // the parents of a path get what is below it
+        nodes[node].below |= below;
+
+        std::string name = path.substr(start, end - start);
+        auto found = nodes[node].children.find(name);
+
+        if (found == nodes[node].children.end()) {
+            nodes.push_back({0, 0, {}});
+            found = nodes[node].children.emplace(name, nodes.size() - 1).first;
+        }
+
+        node = found->second;
+        start = end + 1;
+    }
+
+    nodes[node].bits |= bits;
+}
+
+const RepoStatus::node_t *RepoStatus::find(const std::string &path) const
+{
+    const node_t *node = &nodes[0];
+    size_t start = 0;
+
+    while (node != nullptr && start < path.length()) {
+        size_t end = path.find('/', start);
+
+        if (end == std::string::npos) {
+            end = path.length();
+        }
+
+        auto found = node->children.find(path.substr(start, end - start));
+
+        node = (found != node->children.end()) ? &nodes[found->second] : nullptr;
+        start = end + 1;
+    }
+
+    return node;
+}
+
+unsigned int RepoStatus::file(const std::string &path, bool isdir) const
+{
+    const node_t *node = find(path);
+
+    if (node != nullptr || ignores == nullptr) {
+        return (node != nullptr) ? node->bits : missing;
+    }
+
+    size_t slash = path.rfind('/');
+    size_t name = (slash == std::string::npos) ? 0 : slash + 1;
+
+    // a repository's own .git is never reported as ignored
+    if (path.compare(name, std::string::npos, ".git") == 0) {
+        return 0;
+    }
+
+    return ignores->ignored(path, isdir) ? (GIT_STATUS_IGNORED | GIT_ISTRACKED) : 0;
+}
+
+unsigned int RepoStatus::dir(const std::string &path) const
+{
+    const node_t *node = find(path);
+    return (node != nullptr) ? node->below : missing;
+}
+
+std::shared_ptr<const RepoStatus> StatusCache::get(git_repository *repo,
+                                                   const std::string &scope,
+                                                   const StatHints *hints)
+{
+    std::shared_ptr<slot_t> slot;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Scans &scans = repos[git_repository_path(repo)];
+
+        // scope itself and each of its parents, widest first
+        std::vector<std::string> covering(1);
+
+        for (size_t pos = scope.find('/'); pos != std::string::npos;) {
+            covering.push_back(scope.substr(0, pos));
+            pos = scope.find('/', pos + 1);
+        }
+
+        if (!scope.empty()) {
+            covering.push_back(scope);
+        }
+
+        for (const auto &parent : covering) {
+            auto found = scans.find(parent);
+
+            if (found != scans.end()) {
+                slot = found->second;
+                break;
+            }
+        }
+
+        if (slot == nullptr) {
+            slot = std::make_shared<slot_t>();
+            scans.emplace(scope, slot);
+        }
+    }
+
+    std::call_once(slot->scanned, [&slot, repo, &scope, hints]() {
+        slot->status = std::make_shared<const RepoStatus>(repo, scope, hints);
+    });
+
+    return slot->status;
+}
+
+// the same test libgit2 uses for a directory that is a repository itself
+bool RepoFinder::isgitdir(const std::string &dir)
+{
+    struct stat st = {0};
+
+    return statcache.stat(dir + "/HEAD", &st) == 0 && S_ISREG(st.st_mode) &&
+           statcache.stat(dir + "/objects", &st) == 0 && S_ISDIR(st.st_mode) &&
+           statcache.stat(dir + "/refs", &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+std::string RepoFinder::find(const std::string &dir)
+{
+    std::vector<std::string> visited;
+    std::string curr = dir;
+    std::string root;
+
+    struct stat st = {0};
+    dev_t dev = 0;
+
+    while (statcache.stat(curr, &st) == 0) {
+        if (visited.empty()) {
+            dev = st.st_dev;
+        } else if (st.st_dev != dev) {
+            break;
+        }
+
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            auto found = roots.find(curr);
+
+            if (found != roots.end()) {
+                root = found->second;
+                break;
+            }
+        }
+
+        visited.push_back(curr);
+
+        // .git is a directory, or a file pointing at one for worktrees
+        if (statcache.exists(curr + "/.git") || isgitdir(curr)) {
+            root = curr;
+            break;
+        }
+
+        if (curr == "/") {
+            break;
+        }
+
+        size_t pos = curr.rfind('/');
+        curr = (pos == 0 || pos == std::string::npos) ? "/" : curr.substr(0, pos);
+    }
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+
+    for (const auto &v : visited) {
+        roots.emplace(v, root);
+    }
+
+    return root;
+}
+
+#endif
@@ -0,0 +1,309 @@
+// NOLINTNEXTLINE
+#ifndef GIT_HPP_
+#define GIT_HPP_
+
+class RepoStatus;
+
+#ifdef USE_GIT
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <re2/set.h>
+
+extern "C" {
+#include <git2.h>
+#include <sys/stat.h>
+}
+
+struct status_t {
+    std::string path;
+    // git_status_t bits | GIT_ISTRACKED
+    unsigned int bits;
+    // what the path makes its parent directories: GIT_ISTRACKED, GIT_DIR_DIRTY
+    unsigned int below;
+};
+
+/*
+ * One libgit2 status pass limited to the given literal paths (and what is
+ * below them), "" meaning the whole repository.
+ */
+void scanstatus(git_repository *repo, const std::vector<std::string> &pathspecs,
+                std::vector<status_t> *out);
+
+/*
+ * lstat data a listing collected for the entries of the listed directory,
+ * by path relative to the work directory. It becomes ready once the whole
+ * directory has been read, which the scan started beforehand waits for.
+ */
+using StatHints = std::shared_future<std::unordered_map<std::string, struct stat>>;
+
+/*
+ * The status below scope read straight from a mapped .git/index: entries
+ * whose stat data still matches the work tree are taken as unchanged and
+ * only the rest go through scanstatus(). With a core.fsmonitor hook and
+ * its FSMN extension in the index, entries git saw unchanged and the hook
+ * has not reported since are taken as unchanged without a stat. Entries
+ * directly in scope are compared against hints, when given, and only
+ * lstat'ed when the listing did not stat them. Returns false when the
+ * index cannot tell, e.g. with staged changes.
+ */
+bool indexstatus(git_repository *repo, const std::string &scope,
+                 const StatHints *hints, std::vector<status_t> *out);
+
+/*
+ * What a scan would make of the directory scope, GIT_ISTRACKED and
+ * GIT_DIR_DIRTY, without keeping a status for every path. Index entries
+ * are compared with the work tree until the first one that changed.
+ */
+unsigned int dirtystatus(git_repository *repo, const std::string &scope);
+
+/*
+ * The status below scope from the on-disk cache, rescanning whatever
+ * changed since it was written (as told by the core.fsmonitor hook when
+ * there is one) and writing it back. Returns false when the cache cannot
+ * be used at all.
+ */
+bool cachedstatus(git_repository *repo, const std::string &scope,
+                  std::vector<status_t> *out);
+
+/*
+ * Where the core.fsmonitor hook left off, in the hook protocol the value
+ * belongs to: an opaque token for version 2, nanoseconds for version 1.
+ */
+struct token_t {
+    int version;
+    std::string value;
+
+    bool operator!=(const token_t &o) const
+    {
+        return version != o.version || value != o.value;
+    }
+};
+
+// the hook and protocol version from core.fsmonitor, empty when unset
+std::string fsmonitor(git_repository *repo, int *version);
+
+/*
+ * Runs the hook the way git does, through the shell in the work tree, and
+ * collects the paths it reports changed since token. Fills next with the
+ * token to ask with the next time.
+ */
+bool queryhook(const std::string &hook, const std::string &wd,
+               const token_t &token, token_t *next,
+               std::vector<std::string> *paths);
+
+/*
+ * The patterns of one level of ignore rules, a directory's .gitignore or,
+ * at the root of the work tree, also info/exclude and core.excludesFile,
+ * compiled into a single RE2::Set so that a path is tested against all of
+ * them at once.
+ */
+class IgnoreFile
+{
+public:
+    explicit IgnoreFile(const std::vector<std::string> &sources);
+    virtual ~IgnoreFile() = default;
+
+    IgnoreFile(const IgnoreFile &) = delete;
+    IgnoreFile(IgnoreFile &&other) = delete;
+    IgnoreFile &operator=(const IgnoreFile &other) = delete;
+    IgnoreFile &operator=(IgnoreFile &&other) = delete;
+
+    bool empty() const;
+
+    /*
+     * 1 when path, relative to the directory the patterns were read in,
+     * is ignored, 0 when a negated pattern brings it back and -1 when no
+     * pattern matches at all.
+     */
+    int match(const std::string &path, bool isdir) const;
+private:
+    re2::RE2::Set set;
+    std::vector<bool> negated;
+};
+
+/*
+ * Compiled ignore levels for the whole run, keyed by the directory they
+ * belong to, so sibling directories and later arguments share them. A
+ * directory without patterns is remembered as nullptr.
+ */
+class IgnoreCache
+{
+public:
+    IgnoreCache() = default;
+    virtual ~IgnoreCache() = default;
+
+    IgnoreCache(const IgnoreCache &) = delete;
+    IgnoreCache(IgnoreCache &&other) = delete;
+    IgnoreCache &operator=(const IgnoreCache &other) = delete;
+    IgnoreCache &operator=(IgnoreCache &&other) = delete;
+
+    std::shared_ptr<const IgnoreFile> get(const std::string &key,
+                                          const std::vector<std::string> &sources);
+private:
+    std::shared_mutex lock;
+    std::unordered_map<std::string, std::shared_ptr<const IgnoreFile>> files;
+};
+
+/*
+ * The ignore rules of one work tree, applied the way git does: the closest
+ * level with a matching pattern decides, and nothing below an ignored
+ * directory can be brought back.
+ */
+class GitIgnore
+{
+public:
+    explicit GitIgnore(git_repository *repo);
+    virtual ~GitIgnore() = default;
+
+    GitIgnore(const GitIgnore &) = delete;
+    GitIgnore(GitIgnore &&other) = delete;
+    GitIgnore &operator=(const GitIgnore &other) = delete;
+    GitIgnore &operator=(GitIgnore &&other) = delete;
+
+    // path is relative to the work directory
+    bool ignored(const std::string &path, bool isdir) const;
+private:
+    std::string workdir;
+    std::shared_ptr<const IgnoreFile> root;
+
+    // directories already known to be ignored or not
+    mutable std::shared_mutex lock;
+    mutable std::unordered_map<std::string, bool> dirs;
+
+    bool excluded(const std::string &dir) const;
+    bool matches(const std::string &path, bool isdir) const;
+};
+
+/*
+ * What lsext shows about the paths of one repository below scope, read
+ * with a single status pass into a tree of path components. Paths are
+ * relative to the work directory and have no trailing slash, the root
+ * itself is "".
+ */
+class RepoStatus
+{
+public:
+    RepoStatus(git_repository *repo, const std::string &scope,
+               const StatHints *hints);
+    virtual ~RepoStatus() = default;
+
+    RepoStatus(const RepoStatus &) = delete;
+    RepoStatus(RepoStatus &&other) = delete;
+    RepoStatus &operator=(const RepoStatus &other) = delete;
+    RepoStatus &operator=(RepoStatus &&other) = delete;
+
+    /*
+     * git_status_t bits of a path plus GIT_ISTRACKED when git knows about
+     * it at all, 0 for untracked paths.
+     */
+    unsigned int file(const std::string &path, bool isdir) const;
+
+    /*
+     * GIT_ISTRACKED when anything below a directory is tracked and
+     * GIT_DIR_DIRTY when any of it differs from the index.
+     */
+    unsigned int dir(const std::string &path) const;
+
+    // stands in for a scan that did not finish in time, GIT_UNKNOWN throughout
+    static const RepoStatus &unknown();
+private:
+    RepoStatus();
+
+    struct node_t {
+        // status of this path itself
+        unsigned int bits;
+        // directory flags ORed together from everything below
+        unsigned int below;
+
+        std::unordered_map<std::string, size_t> children;
+    };
+
+    std::vector<node_t> nodes;
+
+    // what paths the scan did not see get
+    unsigned int missing = 0;
+
+    // scans leave ignored paths out, they are matched when asked for
+    std::unique_ptr<const GitIgnore> ignores;
+
+    void insert(const std::string &path, unsigned int bits, unsigned int below);
+    void submodules(git_repository *repo, const std::string &scope);
+    const node_t *find(const std::string &path) const;
+};
+
+/*
+ * Hands out RepoStatus scans for the whole run, keyed by the repository's
+ * git directory and the scanned subtree. A scan of a directory also
+ * answers for everything below it, so a subtree is only scanned when none
+ * of its parents has been. The first caller does the scan, anyone asking
+ * for the same one meanwhile waits for it.
+ */
+class StatusCache
+{
+public:
+    StatusCache() = default;
+    virtual ~StatusCache() = default;
+
+    StatusCache(const StatusCache &) = delete;
+    StatusCache(StatusCache &&other) = delete;
+    StatusCache &operator=(const StatusCache &other) = delete;
+    StatusCache &operator=(StatusCache &&other) = delete;
+
+    std::shared_ptr<const RepoStatus> get(git_repository *repo,
+                                          const std::string &scope,
+                                          const StatHints *hints = nullptr);
+private:
+    struct slot_t {
+        std::once_flag scanned;
+        std::shared_ptr<const RepoStatus> status;
+    };
+
+    std::mutex lock;
+    using Scans = std::unordered_map<std::string, std::shared_ptr<slot_t>>;
+
+    std::unordered_map<std::string, Scans> repos;
+};
+
+/*
+ * Finds the repository a directory belongs to by walking up from it, the
+ * way git does, without crossing into another filesystem. The answer,
+ * "none" included, is remembered for every directory passed on the way,
+ * so later walks stop at the first directory already seen.
+ */
+class RepoFinder
+{
+public:
+    RepoFinder() = default;
+    virtual ~RepoFinder() = default;
+
+    RepoFinder(const RepoFinder &) = delete;
+    RepoFinder(RepoFinder &&other) = delete;
+    RepoFinder &operator=(const RepoFinder &other) = delete;
+    RepoFinder &operator=(RepoFinder &&other) = delete;
+
+    /*
+     * The work directory (or git directory, for bare repositories) of the
+     * repository containing the absolute path dir, "" when there is none.
+     */
+    std::string find(const std::string &dir);
+private:
+    std::shared_mutex lock;
+    std::unordered_map<std::string, std::string> roots;
+
+    static bool isgitdir(const std::string &dir);
+};
+
+extern StatusCache gitstatus;
+extern RepoFinder repofinder;
+extern IgnoreCache ignorecache;
+
+#endif
+
+#endif // GIT_HPP_
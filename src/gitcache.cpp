@@ -0,0 +1,605 @@
+#include "git.hpp"
+#include "cache.hpp"
+#include "entry.hpp"
+
+#ifdef USE_GIT
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <unordered_set>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+}
+
+#define STATUS_CACHE_VERSION "lsext-status 2"
+
+/*
+ * What a path looked like when its status was cached. A path that did not
+ * exist is all zeros, one that changed too close to the scan to be trusted
+ * has msec -1 so it never matches.
+ */
+struct stamp_t {
+    long long msec;
+    long long mnsec;
+    long long csec;
+    long long cnsec;
+    unsigned long long size;
+    unsigned long long ino;
+
+    bool operator==(const stamp_t &o) const
+    {
+        return msec != -1 && msec == o.msec && mnsec == o.mnsec && csec == o.csec &&
+               cnsec == o.cnsec && size == o.size && ino == o.ino;
+    }
+
+    bool operator!=(const stamp_t &o) const
+    {
+        return !(*this == o);
+    }
+};
+
+struct cached_t {
+    status_t status;
+    stamp_t stamp;
+};
+
+struct cacheddir_t {
+    std::string path;
+    stamp_t stamp;
+};
+
+static stamp_t stamp(int result, const struct stat &st, time_t started)
+{
+    if (result != 0) {
+        return {0, 0, 0, 0, 0, 0};
+    }
+
+    // like git's racy-clean check, anything this fresh is looked at again
+    if (st.st_mtime >= started - 1 || st.st_ctime >= started - 1) {
+        return {-1, 0, 0, 0, 0, 0};
+    }
+
+    return {
+        st.st_mtim.tv_sec,
+        st.st_mtim.tv_nsec,
+        st.st_ctim.tv_sec,
+        st.st_ctim.tv_nsec,
+        static_cast<unsigned long long>(st.st_size),
+        static_cast<unsigned long long>(st.st_ino)
+    };
+}
+
+static std::string stampstr(const stamp_t &s)
+{
+    return fmt(
+               "%lld\t%lld\t%lld\t%lld\t%llu\t%llu",
+               s.msec, s.mnsec, s.csec, s.cnsec, s.size, s.ino
+           );
+}
+
+static const char *readstamp(const char *line, stamp_t *s)
+{
+    int len = 0;
+
+    if (sscanf(
+            line,
+            "%lld\t%lld\t%lld\t%lld\t%llu\t%llu\t%n",
+            &s->msec, &s->mnsec, &s->csec, &s->cnsec, &s->size, &s->ino, &len
+        ) != 6 || len == 0) {
+        return nullptr;
+    }
+
+    return line + len;
+}
+
+static std::string cachefile(const std::string &gitdir, const std::string &scope)
+{
+    const char *xdg = std::getenv("XDG_CACHE_HOME");
+    std::string dir;
+
+    if (xdg != nullptr && *xdg == '/') {
+        dir = xdg;
+    } else {
+        const char *home = std::getenv("HOME");
+
+        if (home == nullptr || *home != '/') {
+            return "";
+        }
+
+        dir = std::string(home) + "/.cache";
+    }
+
+    mkdir(dir.c_str(), 0700); // NOLINT
+    dir += "/lsext";
+    mkdir(dir.c_str(), 0700); // NOLINT
+
+    return dir + fmt(
+               "/status-%016zx",
+               std::hash<std::string>()(gitdir + '\n' + scope)
+           );
+}
+
+/*
+ * Everything the cached statuses depend on besides the work tree. Sets racy
+ * when the index or exclude file changed too recently for the header to
+ * tell one version of it from the next.
+ */
+static std::string header(git_repository *repo, const std::string &scope,
+                          bool *racy)
+{
+    std::string gitdir = git_repository_path(repo);
+    struct stat st = {0};
+
+    int idx = stat((gitdir + "index").c_str(), &st);
+    stamp_t index = stamp(idx, st, time(nullptr));
+
+    int exc = stat((gitdir + "info/exclude").c_str(), &st);
+    stamp_t exclude = stamp(exc, st, time(nullptr));
+
+    *racy = (index.msec == -1 || exclude.msec == -1);
+
+    git_oid oid = {};
+    char head[GIT_OID_HEXSZ + 1] = "-";
+
+    if (git_reference_name_to_id(&oid, repo, "HEAD") == 0) {
+        git_oid_tostr(&head[0], sizeof(head), &oid);
+    }
+
+    return std::string(STATUS_CACHE_VERSION) + "\n" +
+           "repo\t" + gitdir + "\n" +
+           "scope\t" + scope + "\n" +
+           "index\t" + stampstr(index) + "\n" +
+           "exclude\t" + stampstr(exclude) + "\n" +
+           "head\t" + &head[0] + "\n";
+}
+
+static bool load(const std::string &file, const std::string &expected,
+                 std::vector<cached_t> *files, std::vector<cacheddir_t> *dirs,
+                 token_t *token)
+{
+    FILE *fp = fopen(file.c_str(), "re");
+
+    if (fp == nullptr) {
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t nread;
+
+    std::string found;
+    bool valid = true;
+
+    for (int i = 0; i < 6 && (nread = getline(&line, &len, fp)) != -1; i++) {
+        found += line;
+    }
+
+    if (found != expected) {
+        valid = false;
+    }
+
+    while (valid && (nread = getline(&line, &len, fp)) != -1) {
+        if (nread > 0 && line[nread - 1] == '\n') {
+            line[nread - 1] = '\0';
+        }
+
+        const char *rest = nullptr;
+        stamp_t s = {};
+        int off = 0;
+
+        if (line[0] == 'd' && line[1] == '\t') {
+            rest = readstamp(line + 2, &s);
+
+            if (rest != nullptr) {
+                dirs->push_back({rest, s});
+            }
+        } else if (line[0] == 'f' && line[1] == '\t') {
+            unsigned int bits = 0;
+            unsigned int below = 0;
+
+            if (sscanf(line + 2, "%u\t%u\t%n", &bits, &below, &off) == 2 && off > 0) {
+                rest = readstamp(line + 2 + off, &s);
+            }
+
+            if (rest != nullptr) {
+                files->push_back({{rest, bits, below}, s});
+            }
+        } else if (line[0] == 't' && line[1] == '\t') {
+            if (sscanf(line + 2, "%d\t%n", &token->version, &off) == 1 && off > 0) {
+                rest = line + 2 + off;
+                token->value = rest;
+            }
+        }
+
+        valid = (rest != nullptr);
+    }
+
+    free(line); // NOLINT
+    fclose(fp);
+
+    return valid;
+}
+
+static void save(const std::string &file, const std::string &head,
+                 const std::vector<cached_t> &files,
+                 const std::vector<cacheddir_t> &dirs, const token_t &token)
+{
+    std::string tmp = file + fmt(".%d", static_cast<int>(getpid()));
+    FILE *fp = fopen(tmp.c_str(), "we");
+
+    if (fp == nullptr) {
+        return;
+    }
+
+    bool ok = fputs(head.c_str(), fp) >= 0;
+
+    if (!token.value.empty()) {
+        ok = ok && fprintf(fp, "t\t%d\t%s\n", token.version, token.value.c_str()) > 0;
+    }
+
+    for (const auto &d : dirs) {
+        ok = ok && fprintf(
+                       fp, "d\t%s\t%s\n",
+                       stampstr(d.stamp).c_str(), d.path.c_str()
+                   ) > 0;
+    }
+
+    for (const auto &f : files) {
+        ok = ok && fprintf(
+                       fp, "f\t%u\t%u\t%s\t%s\n",
+                       f.status.bits, f.status.below,
+                       stampstr(f.stamp).c_str(), f.status.path.c_str()
+                   ) > 0;
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+static std::string parent(const std::string &path)
+{
+    size_t pos = path.rfind('/');
+    return (pos == std::string::npos) ? "" : path.substr(0, pos);
+}
+
+static bool below(const std::string &path, const std::string &dir)
+{
+    return dir.empty() || path == dir || (
+               path.length() > dir.length() &&
+               path.compare(0, dir.length(), dir) == 0 &&
+               path[dir.length()] == '/'
+           );
+}
+
+std::string fsmonitor(git_repository *repo, int *version)
+{
+    git_config *cfg = nullptr;
+    std::string hook;
+
+    if (git_repository_config_snapshot(&cfg, repo) != 0) {
+        return hook;
+    }
+
+    git_buf buf = {nullptr, 0, 0};
+    int enabled = 0;
+    int32_t v = 0;
+
+    // a boolean means git's own daemon, which only git can talk to
+    if (git_config_get_bool(&enabled, cfg, "core.fsmonitor") != 0 &&
+        git_config_get_path(&buf, cfg, "core.fsmonitor") == 0) {
+        hook = buf.ptr;
+        git_buf_dispose(&buf);
+    }
+
+    *version = (git_config_get_int32(&v, cfg, "core.fsmonitorhookversion") == 0) ? v : 0;
+
+    git_config_free(cfg);
+
+    return hook;
+}
+
+// what the hook is handed before it has ever been asked, as git does
+static token_t firsttoken(int version)
+{
+    if (version == 1) {
+        struct timespec now = {0, 0};
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        return {1, std::to_string(now.tv_sec * 1000000000LL + now.tv_nsec)};
+    }
+
+    return {2, "builtin:fake"};
+}
+
+bool queryhook(const std::string &hook, const std::string &wd,
+               const token_t &token, token_t *next,
+               std::vector<std::string> *paths)
+{
+    token_t now = firsttoken(token.version);
+    std::string command = hook + " \"$@\"";
+    std::string version = std::to_string(token.version);
+
+    int fds[2];
+
+    if (pipe2(&fds[0], O_CLOEXEC) != 0) {
+        return false;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+        if (null != -1) {
+            dup2(null, STDIN_FILENO);
+        }
+
+        dup2(fds[1], STDOUT_FILENO);
+
+        if (chdir(wd.c_str()) == 0) {
+            execl(
+                "/bin/sh", "sh", "-c", command.c_str(), "sh",
+                version.c_str(), token.value.c_str(), nullptr
+            );
+        }
+
+        _exit(127); // NOLINT
+    }
+
+    close(fds[1]);
+
+    std::string output;
+
+    if (pid != -1) {
+        char buf[4096]; // NOLINT
+        ssize_t len;
+
+        while ((len = read(fds[0], &buf[0], sizeof(buf))) != 0) {
+            if (len > 0) {
+                output.append(&buf[0], len);
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+    }
+
+    close(fds[0]);
+
+    int status = 0;
+
+    while (pid != -1 && waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+
+    if (pid == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+
+    size_t pos = 0;
+
+    if (token.version == 2) {
+        pos = output.find('\0');
+
+        if (pos == std::string::npos || pos == 0) {
+            return false;
+        }
+
+        now.value = output.substr(0, pos++);
+    }
+
+    while (pos < output.length()) {
+        size_t end = output.find('\0', pos);
+
+        if (end == std::string::npos) {
+            end = output.length();
+        }
+
+        if (end > pos) {
+            paths->push_back(output.substr(pos, end - pos));
+        }
+
+        pos = end + 1;
+    }
+
+    *next = now;
+
+    return true;
+}
+
+bool cachedstatus(git_repository *repo, const std::string &scope,
+                  std::vector<status_t> *out)
+{
+    const char *workdir = git_repository_workdir(repo);
+
+    if (workdir == nullptr) {
+        return false;
+    }
+
+    std::string wd = workdir;
+    std::string file = cachefile(git_repository_path(repo), scope);
+
+    if (file.empty()) {
+        return false;
+    }
+
+    time_t started = time(nullptr);
+    bool racy = false;
+    std::string head = header(repo, scope, &racy);
+
+    std::vector<cached_t> files;
+    std::vector<cacheddir_t> dirs;
+    std::vector<std::string> changed;
+
+    token_t token = {0, ""};
+    bool loaded = !racy && load(file, head, &files, &dirs, &token);
+
+    int configured = 0;
+    std::string hook = fsmonitor(repo, &configured);
+
+    token_t next = {0, ""};
+    std::vector<std::string> reported;
+    bool watched = false;
+
+    if (!hook.empty()) {
+        int version = (configured == 1 || configured == 2) ? configured :
+                      (token.version == 1) ? 1 : 2;
+
+        if (loaded && token.version == version) {
+            watched = queryhook(hook, wd, token, &next, &reported);
+
+            // like git, an unset version falls back to the older protocol
+            if (!watched && configured == 0) {
+                version = 3 - version;
+            }
+        }
+
+        if (!watched) {
+            next = firsttoken(version);
+        }
+
+        // "/" is the hook saying it cannot tell what changed
+        watched = watched &&
+                  std::find(reported.begin(), reported.end(), "/") == reported.end();
+    }
+
+    struct stat st = {0};
+
+    if (!loaded) {
+        files.clear();
+        changed.push_back(scope);
+    } else if (watched) {
+        GitIgnore ignores(repo);
+
+        // every cached path and every directory holding one
+        std::unordered_set<std::string> tracked;
+
+        for (const auto &f : files) {
+            tracked.insert(f.status.path);
+        }
+
+        for (const auto &d : dirs) {
+            tracked.insert(d.path);
+        }
+
+        for (auto p : reported) {
+            bool isdir = p.back() == '/';
+
+            if (isdir) {
+                p.pop_back();
+            }
+
+            if (below(p, ".git")) {
+                continue;
+            }
+
+            /*
+             * Scans leave ignored paths out, so build output churning in
+             * the work tree, next to tracked files or in ignored
+             * directories, is of no interest unless git tracks it.
+             */
+            if (tracked.count(p) == 0 && ignores.ignored(p, isdir)) {
+                continue;
+            }
+
+            if (below(p, scope)) {
+                changed.push_back((p == scope) ? p : parent(p));
+            } else if (below(scope, p)) {
+                changed.push_back(scope);
+            }
+        }
+    } else {
+        // a directory changes when entries come and go in it
+        for (const auto &d : dirs) {
+            if (stamp(statcache.stat(wd + d.path, &st), st, started) != d.stamp) {
+                changed.push_back(d.path);
+            }
+        }
+
+        // and the files in it when they are written to in place
+        for (const auto &f : files) {
+            int result = statcache.lstat(wd + f.status.path, &st);
+
+            if (stamp(result, st, started) != f.stamp) {
+                changed.push_back(parent(f.status.path));
+            }
+        }
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    // rescanning a directory covers everything below it
+    std::vector<std::string> roots;
+
+    for (const auto &c : changed) {
+        if (roots.empty() || !below(c, roots.back())) {
+            roots.push_back(c);
+        }
+    }
+
+    changed = roots;
+
+    bool cacheable = true;
+
+    if (!changed.empty()) {
+        std::vector<status_t> fresh;
+
+        scanstatus(repo, changed, &fresh);
+
+        files.erase(std::remove_if(files.begin(), files.end(), [&changed](const cached_t &f) {
+            return std::any_of(changed.begin(), changed.end(), [&f](const std::string &c) {
+                return below(f.status.path, c);
+            });
+        }), files.end());
+
+        for (auto &f : fresh) {
+            int result = statcache.lstat(wd + f.path, &st);
+
+            cacheable = cacheable && f.path.find('\n') == std::string::npos;
+            files.push_back({std::move(f), stamp(result, st, started)});
+        }
+
+        // every directory holding a cached path, up to the scope
+        std::unordered_set<std::string> seen = {scope};
+
+        for (const auto &f : files) {
+            std::string d = parent(f.status.path);
+
+            while (below(d, scope) && d != scope && seen.insert(d).second) {
+                d = parent(d);
+            }
+        }
+
+        dirs.clear();
+
+        for (const auto &d : seen) {
+            dirs.push_back({d, stamp(statcache.stat(wd + d, &st), st, started)});
+        }
+    }
+
+    // a racy header would match the next one whatever happens in between
+    if (!racy && cacheable && (!changed.empty() || next != token)) {
+        save(file, head, files, dirs, next);
+    }
+
+    out->reserve(files.size());
+
+    for (auto &f : files) {
+        out->push_back(std::move(f.status));
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,338 @@
+#include "git.hpp"
+#include "cache.hpp"
+#include "entry.hpp"
+
+#ifdef USE_GIT
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+IgnoreCache ignorecache;
+
+/*
+ * A gitignore glob as a regular expression over the path relative to the
+ * directory it was read in. "*", "?" and brackets stay within one path
+ * component, "**" as a whole component spans any number of them. None of
+ * them match the NUL that marks directories, see IgnoreFile::match().
+ */
+static std::string globtoregex(const std::string &glob)
+{
+    std::string re;
+    size_t n = glob.length();
+
+    for (size_t i = 0; i < n; ++i) {
+        char c = glob[i];
+
+        if (c == '*') {
+            size_t stars = 1;
+
+            while (i + stars < n && glob[i + stars] == '*') {
+                stars++;
+            }
+
+            bool whole = stars == 2 && (i == 0 || glob[i - 1] == '/') &&
+                         (i + 2 == n || glob[i + 2] == '/');
+
+            if (whole && i + 2 == n) {
+                re += ".+";
+            } else if (whole) {
+                re += "(?:.*/)?";
+                i++;
+            } else {
+                re += "[^/\\x00]*";
+            }
+
+            i += stars - 1;
+        } else if (c == '?') {
+            re += "[^/\\x00]";
+        } else if (c == '[') {
+            size_t j = i + 1;
+
+            if (j < n && (glob[j] == '!' || glob[j] == '^')) {
+                j++;
+            }
+
+            // a ']' right after the opening bracket is part of the class
+            if (j < n && glob[j] == ']') {
+                j++;
+            }
+
+            while (j < n && glob[j] != ']') {
+                j += (glob[j] == '\\' && j + 1 < n) ? 2 : 1;
+            }
+
+            if (j >= n) {
+                re += "\\[";
+                continue;
+            }
+
+            size_t k = i + 1;
+            re += "[";
+
+            if (glob[k] == '!' || glob[k] == '^') {
+                re += "^/\\x00";
+                k++;
+            }
+
+            for (; k < j; ++k) {
+                if (glob[k] == '\\' && k + 1 < j) {
+                    k++;
+                }
+
+                if (glob[k] == '[' || glob[k] == ']' || glob[k] == '^' || glob[k] == '\\') {
+                    re += '\\';
+                }
+
+                re += glob[k];
+            }
+
+            re += "]";
+            i = j;
+        } else if (c == '\\' && i + 1 < n) {
+            re += re2::RE2::QuoteMeta(glob.substr(++i, 1));
+        } else {
+            re += re2::RE2::QuoteMeta(glob.substr(i, 1));
+        }
+    }
+
+    return re;
+}
+
+static re2::RE2::Options ignoreoptions()
+{
+    re2::RE2::Options options;
+
+    options.set_encoding(re2::RE2::Options::EncodingLatin1);
+    options.set_dot_nl(true);
+    options.set_log_errors(false);
+
+    return options;
+}
+
+IgnoreFile::IgnoreFile(const std::vector<std::string> &sources) :
+    set(ignoreoptions(), re2::RE2::ANCHOR_BOTH)
+{
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t nread;
+
+    for (const auto &source : sources) {
+        FILE *fp = fopen(source.c_str(), "re");
+
+        if (fp == nullptr) {
+            continue;
+        }
+
+        while ((nread = getline(&line, &len, fp)) != -1) {
+            std::string pattern(line, nread);
+
+            while (!pattern.empty() && (pattern.back() == '\n' || pattern.back() == '\r')) {
+                pattern.pop_back();
+            }
+
+            // trailing spaces go unless escaped
+            while (
+                !pattern.empty() && pattern.back() == ' ' &&
+                (pattern.length() < 2 || pattern[pattern.length() - 2] != '\\')
+            ) {
+                pattern.pop_back();
+            }
+
+            if (pattern.empty() || pattern[0] == '#') {
+                continue;
+            }
+
+            bool negate = pattern[0] == '!';
+
+            if (negate) {
+                pattern.erase(0, 1);
+            }
+
+            // directories are matched with a trailing NUL, see match()
+            bool dironly = !pattern.empty() && pattern.back() == '/';
+
+            if (dironly) {
+                pattern.pop_back();
+            }
+
+            if (pattern.empty()) {
+                continue;
+            }
+
+            // a slash anywhere but the end ties the pattern to this directory
+            bool anchored = pattern.find('/') != std::string::npos;
+
+            if (pattern[0] == '/') {
+                pattern.erase(0, 1);
+            }
+
+            std::string re = (anchored ? "" : "(?:.*/)?") + globtoregex(pattern) +
+                             (dironly ? "\\x00" : "\\x00?");
+
+            if (set.Add(re, nullptr) != -1) {
+                negated.push_back(negate);
+            }
+        }
+
+        fclose(fp);
+    }
+
+    free(line); // NOLINT
+
+    if (!negated.empty() && !set.Compile()) {
+        negated.clear();
+    }
+}
+
+bool IgnoreFile::empty() const
+{
+    return negated.empty();
+}
+
+int IgnoreFile::match(const std::string &path, bool isdir) const
+{
+    std::vector<int> matched;
+
+    // a NUL cannot be part of a path, unlike a slash it is never a separator
+    std::string subject = path;
+
+    if (isdir) {
+        subject += '\0';
+    }
+
+    if (!set.Match(subject, &matched) || matched.empty()) {
+        return -1;
+    }
+
+    // the last pattern that matches decides
+    int last = *std::max_element(matched.begin(), matched.end());
+
+    return negated[last] ? 0 : 1;
+}
+
+std::shared_ptr<const IgnoreFile> IgnoreCache::get(
+    const std::string &key, const std::vector<std::string> &sources)
+{
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        auto found = files.find(key);
+
+        if (found != files.end()) {
+            return found->second;
+        }
+    }
+
+    auto file = std::make_shared<const IgnoreFile>(sources);
+
+    if (file->empty()) {
+        file = nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+
+    return files.emplace(key, file).first->second;
+}
+
+GitIgnore::GitIgnore(git_repository *repo)
+{
+    const char *wd = git_repository_workdir(repo);
+    std::string gitdir = git_repository_path(repo);
+
+    workdir = (wd != nullptr) ? wd : "";
+
+    std::string excludes;
+    git_config *cfg = nullptr;
+    git_buf buf = {nullptr, 0, 0};
+
+    if (git_repository_config_snapshot(&cfg, repo) == 0) {
+        if (git_config_get_path(&buf, cfg, "core.excludesfile") == 0) {
+            excludes = buf.ptr;
+            git_buf_dispose(&buf);
+        }
+
+        git_config_free(cfg);
+    }
+
+    if (excludes.empty()) {
+        const char *xdg = std::getenv("XDG_CONFIG_HOME");
+        const char *home = std::getenv("HOME");
+
+        if (xdg != nullptr && *xdg != '\0') {
+            excludes = std::string(xdg) + "/git/ignore";
+        } else if (home != nullptr) {
+            excludes = std::string(home) + "/.config/git/ignore";
+        }
+    }
+
+    // lowest precedence first, the last pattern matching wins
+    root = ignorecache.get(gitdir, {
+        excludes,
+        gitdir + "info/exclude",
+        workdir + ".gitignore"
+    });
+}
+
+bool GitIgnore::ignored(const std::string &path, bool isdir) const
+{
+    size_t slash = path.rfind('/');
+
+    // nothing below an ignored directory can be brought back
+    if (slash != std::string::npos && excluded(path.substr(0, slash))) {
+        return true;
+    }
+
+    return matches(path, isdir);
+}
+
+bool GitIgnore::excluded(const std::string &dir) const
+{
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        auto found = dirs.find(dir);
+
+        if (found != dirs.end()) {
+            return found->second;
+        }
+    }
+
+    size_t slash = dir.rfind('/');
+    bool result = (slash != std::string::npos && excluded(dir.substr(0, slash))) ||
+                  matches(dir, true);
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    dirs.emplace(dir, result);
+
+    return result;
+}
+
+bool GitIgnore::matches(const std::string &path, bool isdir) const
+{
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "" : path.substr(0, slash);
+
+    // the .gitignore closest to the path decides first
+    while (true) {
+        auto rules = dir.empty() ? root : ignorecache.get(
+                         workdir + dir,
+                         {workdir + dir + "/.gitignore"}
+                     );
+
+        if (rules != nullptr) {
+            int result = rules->match(dir.empty() ? path : path.substr(dir.length() + 1), isdir);
+
+            if (result != -1) {
+                return result == 1;
+            }
+        }
+
+        if (dir.empty()) {
+            return false;
+        }
+
+        slash = dir.rfind('/');
+        dir = (slash == std::string::npos) ? "" : dir.substr(0, slash);
+    }
+}
+
+#endif
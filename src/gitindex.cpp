@@ -0,0 +1,872 @@
+#include "git.hpp"
+#include "entry.hpp"
+
+#ifdef USE_GIT
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+}
+
+#define INDEX_HEADER_SIZE 12
+#define INDEX_HASH_SIZE 20
+
+// stat data, object id and flags in front of the path of an entry
+#define ENTRY_FIXED_SIZE 62
+#define ENTRY_FLAGS_OFFSET 60
+
+#define ENTRY_ASSUME_VALID 0x8000
+#define ENTRY_EXTENDED 0x4000
+#define ENTRY_STAGE 0x3000
+#define ENTRY_NAME_MASK 0x0fff
+
+#define ENTRY_SKIP_WORKTREE 0x4000
+#define ENTRY_INTENT_TO_ADD 0x2000
+
+#define INDEX_MODE_LINK 0120000
+#define INDEX_MODE_GITLINK 0160000
+
+// below this many entries lstat'ing them is cheaper than running the hook
+#define FSMONITOR_MIN_ENTRIES 1024
+
+// entries with stale stat data hashed one by one before the rest go at once
+#define DIRTY_PROBES_MAX 16
+
+// where the object id sits in an entry, after the stat data
+#define ENTRY_OID_OFFSET 40
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | // NOLINT
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]); // NOLINT
+}
+
+static uint16_t be16(const unsigned char *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]); // NOLINT
+}
+
+static uint64_t be64(const unsigned char *p)
+{
+    return (static_cast<uint64_t>(be32(p)) << 32) | be32(p + 4); // NOLINT
+}
+
+/*
+ * .git/index mapped read-only, with the offset of each entry so the sorted
+ * paths can be binary searched. Only versions 2 and 3 are read, version 4
+ * compresses paths against the previous entry.
+ */
+class IndexFile
+{
+public:
+    IndexFile() = default;
+    virtual ~IndexFile();
+
+    IndexFile(const IndexFile &) = delete;
+    IndexFile(IndexFile &&other) = delete;
+    IndexFile &operator=(const IndexFile &other) = delete;
+    IndexFile &operator=(IndexFile &&other) = delete;
+
+    bool open(const std::string &file);
+
+    struct entry_t {
+        const unsigned char *data;
+        const char *path;
+        size_t pathlen;
+        uint16_t flags;
+        uint16_t extended;
+    };
+
+    size_t size() const
+    {
+        return offsets.size();
+    }
+
+    entry_t entry(size_t i) const;
+
+    // first entry whose path is not before prefix
+    size_t lowerbound(const std::string &prefix) const;
+
+    // extensions follow the entries, up to the trailing checksum
+    const unsigned char *extensions = nullptr;
+    const unsigned char *end = nullptr;
+
+    struct timespec mtime = {0, 0};
+private:
+    unsigned char *map = nullptr;
+    size_t length = 0;
+    uint32_t version = 0;
+
+    std::vector<size_t> offsets;
+};
+
+IndexFile::~IndexFile()
+{
+    if (map != nullptr) {
+        munmap(map, length);
+    }
+}
+
+bool IndexFile::open(const std::string &file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st = {0};
+
+    if (fstat(fd, &st) != 0 || st.st_size < INDEX_HEADER_SIZE + INDEX_HASH_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    length = st.st_size;
+    mtime = st.st_mtim;
+
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        length = 0;
+        return false;
+    }
+
+    map = static_cast<unsigned char *>(mapped);
+    end = map + length - INDEX_HASH_SIZE;
+
+    version = be32(map + 4); // NOLINT
+
+    if (memcmp(map, "DIRC", 4) != 0 || (version != 2 && version != 3)) {
+        return false;
+    }
+
+    uint32_t count = be32(map + 8); // NOLINT
+    const unsigned char *p = map + INDEX_HEADER_SIZE;
+
+    offsets.reserve(count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (end - p < ENTRY_FIXED_SIZE) {
+            return false;
+        }
+
+        uint16_t flags = be16(p + ENTRY_FLAGS_OFFSET);
+        size_t name = ENTRY_FIXED_SIZE + (((flags & ENTRY_EXTENDED) != 0) ? 2 : 0);
+
+        if (static_cast<size_t>(end - p) <= name) {
+            return false;
+        }
+
+        size_t len = flags & ENTRY_NAME_MASK;
+
+        if (len == ENTRY_NAME_MASK) {
+            const void *nul = memchr(p + name, 0, end - p - name);
+
+            if (nul == nullptr) {
+                return false;
+            }
+
+            len = static_cast<const unsigned char *>(nul) - (p + name);
+        }
+
+        // padded with one to eight NULs to a multiple of eight
+        size_t entrylen = (name + len + 8) & ~static_cast<size_t>(7); // NOLINT
+
+        if (static_cast<size_t>(end - p) < entrylen) {
+            return false;
+        }
+
+        offsets.push_back(p - map);
+        p += entrylen;
+    }
+
+    extensions = p;
+
+    return true;
+}
+
+IndexFile::entry_t IndexFile::entry(size_t i) const
+{
+    const unsigned char *p = map + offsets[i];
+    uint16_t flags = be16(p + ENTRY_FLAGS_OFFSET);
+    uint16_t extended = 0;
+    size_t name = ENTRY_FIXED_SIZE;
+
+    if ((flags & ENTRY_EXTENDED) != 0) {
+        extended = be16(p + ENTRY_FIXED_SIZE);
+        name += 2;
+    }
+
+    const char *path = reinterpret_cast<const char *>(p + name); // NOLINT
+
+    return {p, path, strlen(path), flags, extended};
+}
+
+size_t IndexFile::lowerbound(const std::string &prefix) const
+{
+    size_t lo = 0;
+    size_t hi = offsets.size();
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        entry_t e = entry(mid);
+
+        if (strncmp(e.path, prefix.c_str(), prefix.length()) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * The cache-tree (TREE extension) is a preorder list of the directories
+ * whose tree object is still known, each as "path\0count subtrees\n" and
+ * the object id when count is not -1.
+ */
+static const unsigned char *findtree(const unsigned char *p, const unsigned char *end,
+                                     const std::string &parent,
+                                     const std::string &scope, git_oid *oid,
+                                     int *found)
+{
+    const void *nul = memchr(p, 0, end - p);
+
+    if (nul == nullptr) {
+        return nullptr;
+    }
+
+    std::string name(reinterpret_cast<const char *>(p), // NOLINT
+                     static_cast<const unsigned char *>(nul) - p);
+    std::string path = parent.empty() ? name : parent + "/" + name;
+
+    p = static_cast<const unsigned char *>(nul) + 1;
+
+    const void *nl = memchr(p, '\n', end - p);
+    int count = 0;
+    int subtrees = 0;
+
+    if (nl == nullptr || sscanf(
+            std::string(reinterpret_cast<const char *>(p), // NOLINT
+                        static_cast<const unsigned char *>(nl) - p).c_str(),
+            "%d %d", &count, &subtrees
+        ) != 2) {
+        return nullptr;
+    }
+
+    p = static_cast<const unsigned char *>(nl) + 1;
+
+    if (count >= 0) {
+        if (end - p < INDEX_HASH_SIZE) {
+            return nullptr;
+        }
+
+        if (path == scope) {
+            git_oid_fromraw(oid, p);
+            *found = 1;
+        }
+
+        p += INDEX_HASH_SIZE;
+    } else if (path == scope) {
+        *found = -1;
+    }
+
+    for (int i = 0; i < subtrees && p != nullptr; ++i) {
+        p = findtree(p, end, path, scope, oid, found);
+    }
+
+    return p;
+}
+
+// whether a split or sparse index keeps entries elsewhere
+static bool partial(const IndexFile &index)
+{
+    for (const unsigned char *p = index.extensions; index.end - p >= 8;) {
+        uint32_t size = be32(p + 4);
+
+        if (static_cast<size_t>(index.end - p - 8) < size) {
+            return true;
+        }
+
+        if (memcmp(p, "link", 4) == 0 || memcmp(p, "sdir", 4) == 0) {
+            return true;
+        }
+
+        p += 8 + size;
+    }
+
+    return false;
+}
+
+/*
+ * Whether the index holds exactly what HEAD has below scope, read off the
+ * cache-tree. False as well when that cannot be told cheaply.
+ */
+static bool unstaged(git_repository *repo, const IndexFile &index,
+                     const std::string &scope, bool empty)
+{
+    git_oid cached = {};
+    int found = 0;
+
+    if (partial(index)) {
+        return false;
+    }
+
+    for (const unsigned char *p = index.extensions; index.end - p >= 8;) {
+        uint32_t size = be32(p + 4);
+
+        if (static_cast<size_t>(index.end - p - 8) < size) {
+            return false;
+        }
+
+        if (memcmp(p, "TREE", 4) == 0 && size > 0 &&
+            findtree(p + 8, p + 8 + size, "", scope, &cached, &found) == nullptr) {
+            return false;
+        }
+
+        p += 8 + size;
+    }
+
+    git_oid head = {};
+    git_commit *commit = nullptr;
+    git_tree *tree = nullptr;
+    git_tree_entry *entry = nullptr;
+
+    bool same = false;
+
+    if (git_reference_name_to_id(&head, repo, "HEAD") != 0) {
+        // nothing committed yet, so nothing may be staged either
+        return empty;
+    }
+
+    if (git_commit_lookup(&commit, repo, &head) != 0) {
+        return false;
+    }
+
+    if (scope.empty()) {
+        same = found == 1 && git_oid_cmp(&cached, git_commit_tree_id(commit)) == 0;
+    } else if (git_commit_tree(&tree, commit) == 0) {
+        int error = git_tree_entry_bypath(&entry, tree, scope.c_str());
+
+        if (error == 0) {
+            same = found == 1 && git_oid_cmp(&cached, git_tree_entry_id(entry)) == 0;
+            git_tree_entry_free(entry);
+        } else {
+            same = empty && error == GIT_ENOTFOUND;
+        }
+
+        git_tree_free(tree);
+    }
+
+    git_commit_free(commit);
+
+    return same;
+}
+
+/*
+ * The bits of an EWAH bitmap the way git writes them: the number of bits
+ * and of 64-bit words, then the words. Each marker word stands for a run of
+ * all-zero or all-one words and tells how many literal words follow it.
+ */
+static bool ewah(const unsigned char *p, const unsigned char *end,
+                 std::vector<bool> *bits)
+{
+    if (end - p < 8) {
+        return false;
+    }
+
+    uint32_t count = be32(p);
+    uint32_t words = be32(p + 4);
+
+    p += 8;
+
+    if (static_cast<size_t>(end - p) / 8 < words) {
+        return false;
+    }
+
+    bits->assign(count, false);
+
+    size_t pos = 0;
+
+    for (uint32_t w = 0; w < words;) {
+        uint64_t marker = be64(p + 8 * w++); // NOLINT
+        size_t run = ((marker >> 1) & 0xffffffff) * 64; // NOLINT
+
+        for (size_t i = pos; (marker & 1) != 0 && i < pos + run && i < count; ++i) {
+            (*bits)[i] = true;
+        }
+
+        pos += run;
+
+        for (uint64_t literal = marker >> 33; literal > 0 && w < words; --literal) { // NOLINT
+            uint64_t word = be64(p + 8 * w++); // NOLINT
+
+            for (size_t b = 0; b < 64 && pos + b < count; ++b) { // NOLINT
+                (*bits)[pos + b] = ((word >> b) & 1) != 0;
+            }
+
+            pos += 64; // NOLINT
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The token git last asked core.fsmonitor with, from the FSMN extension,
+ * and the entries it had not seen unchanged by then. Entries past the end
+ * of the bitmap were.
+ */
+static bool monitored(const IndexFile &index, std::string *token,
+                      std::vector<bool> *dirty)
+{
+    for (const unsigned char *p = index.extensions; index.end - p >= 8;) {
+        uint32_t size = be32(p + 4);
+
+        if (static_cast<size_t>(index.end - p - 8) < size) {
+            return false;
+        }
+
+        const unsigned char *q = p + 8;
+        const unsigned char *end = q + size;
+
+        p = end;
+
+        if (memcmp(q - 8, "FSMN", 4) != 0 || size < 4) {
+            continue;
+        }
+
+        uint32_t version = be32(q);
+        q += 4;
+
+        if (version == 1 && end - q >= 8) {
+            *token = std::to_string(be64(q));
+            q += 8;
+        } else if (version == 2 && memchr(q, 0, end - q) != nullptr) {
+            *token = reinterpret_cast<const char *>(q); // NOLINT
+            q += token->length() + 1;
+        } else {
+            return false;
+        }
+
+        if (end - q < 4 || static_cast<size_t>(end - q - 4) < be32(q)) {
+            return false;
+        }
+
+        if (!ewah(q + 4, q + 4 + be32(q), dirty) || dirty->size() > index.size()) {
+            return false;
+        }
+
+        dirty->resize(index.size(), false);
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Asks the core.fsmonitor hook what changed since git last did and marks
+ * every entry at or below a reported path dirty. False when there is no
+ * hook, it fails or cannot tell.
+ */
+static bool fsmonitored(git_repository *repo, const std::string &wd,
+                        const IndexFile &index, std::vector<bool> *dirty)
+{
+    int configured = 0;
+    std::string hook = fsmonitor(repo, &configured);
+    std::string token;
+
+    if (hook.empty() || !monitored(index, &token, dirty)) {
+        return false;
+    }
+
+    std::vector<std::string> reported;
+    token_t next = {0, ""};
+
+    bool watched = queryhook(hook, wd, {(configured == 1) ? 1 : 2, token}, &next, &reported);
+
+    // like git, an unset version falls back to the older protocol
+    if (!watched && configured == 0) {
+        watched = queryhook(hook, wd, {1, token}, &next, &reported);
+    }
+
+    // "/" is the hook saying it cannot tell what changed
+    if (!watched || std::find(reported.begin(), reported.end(), "/") != reported.end()) {
+        return false;
+    }
+
+    for (auto p : reported) {
+        if (!p.empty() && p.back() == '/') {
+            p.pop_back();
+        }
+
+        size_t i = index.lowerbound(p);
+
+        if (i < index.size() && p == index.entry(i).path) {
+            (*dirty)[i] = true;
+        }
+
+        // a directory, or a path that was one, stands for all below it
+        p += '/';
+
+        for (i = index.lowerbound(p); i < index.size() &&
+             strncmp(index.entry(i).path, p.c_str(), p.length()) == 0; ++i) {
+            (*dirty)[i] = true;
+        }
+    }
+
+    return true;
+}
+
+static bool timeeq(const unsigned char *p, const struct timespec &ts)
+{
+    uint32_t nsec = be32(p + 4);
+
+    // an index written without nanoseconds only has the seconds to go by
+    return be32(p) == static_cast<uint32_t>(ts.tv_sec) &&
+           (nsec == 0 || nsec == static_cast<uint32_t>(ts.tv_nsec));
+}
+
+/*
+ * What of the work tree is compared against the stat data in the index,
+ * as core.trustctime and core.filemode say.
+ */
+static void statoptions(git_repository *repo, int *trustctime, int *filemode)
+{
+    git_config *cfg = nullptr;
+
+    *trustctime = 1;
+    *filemode = 1;
+
+    if (git_repository_config_snapshot(&cfg, repo) == 0) {
+        git_config_get_bool(trustctime, cfg, "core.trustctime");
+        git_config_get_bool(filemode, cfg, "core.filemode");
+        git_config_free(cfg);
+    }
+}
+
+// whether the stat data of entry e still describes the file, if st is
+static bool unchanged(const IndexFile &index, const IndexFile::entry_t &e,
+                      const struct stat *st, int trustctime, int filemode)
+{
+    uint32_t mode = be32(e.data + 24); // NOLINT
+
+    if (st == nullptr) {
+        return false;
+    }
+
+    uint32_t type = S_ISLNK(st->st_mode) ? INDEX_MODE_LINK : // NOLINT
+                    (S_ISREG(st->st_mode) && filemode && (st->st_mode & S_IXUSR) != 0) ? // NOLINT
+                    0100755 : S_ISREG(st->st_mode) ? 0100644 : 0; // NOLINT
+
+    return (filemode ? mode == type : (mode & 0170000) == (type & 0170000)) && // NOLINT
+           timeeq(e.data + 8, st->st_mtim) && // NOLINT
+           (!trustctime || timeeq(e.data, st->st_ctim)) &&
+           be32(e.data + 20) == static_cast<uint32_t>(st->st_ino) && // NOLINT
+           be32(e.data + 28) == st->st_uid && // NOLINT
+           be32(e.data + 32) == st->st_gid && // NOLINT
+           be32(e.data + 36) == static_cast<uint32_t>(st->st_size) && // NOLINT
+           // written no earlier than the index, so equal stat data proves nothing
+           be32(e.data + 8) < static_cast<uint32_t>(index.mtime.tv_sec); // NOLINT
+}
+
+// the entries below scope, which sort together
+static void scoperange(const IndexFile &index, const std::string &scope,
+                       size_t *first, size_t *last)
+{
+    std::string prefix = scope.empty() ? "" : scope + "/";
+
+    *first = index.lowerbound(prefix);
+    *last = *first;
+
+    while (*last < index.size() &&
+           strncmp(index.entry(*last).path, prefix.c_str(), prefix.length()) == 0) {
+        (*last)++;
+    }
+}
+
+bool indexstatus(git_repository *repo, const std::string &scope,
+                 const StatHints *hints, std::vector<status_t> *out)
+{
+    const char *workdir = git_repository_workdir(repo);
+
+    if (workdir == nullptr) {
+        return false;
+    }
+
+    std::string wd = workdir;
+    IndexFile index;
+
+    if (!index.open(std::string(git_repository_path(repo)) + "index")) {
+        return false;
+    }
+
+    std::string prefix = scope.empty() ? "" : scope + "/";
+    size_t first = 0;
+    size_t last = 0;
+
+    scoperange(index, scope, &first, &last);
+
+    if (!unstaged(repo, index, scope, first == last)) {
+        return false;
+    }
+
+    int trustctime = 1;
+    int filemode = 1;
+
+    statoptions(repo, &trustctime, &filemode);
+
+    std::vector<status_t> clean;
+    std::vector<std::string> changed;
+
+    // entries the hook vouches for, as git would, when there are enough
+    std::vector<bool> dirty;
+    bool watched = last - first >= FSMONITOR_MIN_ENTRIES &&
+                   fsmonitored(repo, wd, index, &dirty);
+
+    // entries directly in scope, held back until the listing has stat'ed them
+    std::vector<size_t> listed;
+
+    clean.reserve(last - first);
+
+    /*
+     * Every entry is looked at once, so unlike the listing's paths they are
+     * not worth keeping in statcache. They are stat'ed against the work
+     * tree's fd instead.
+     */
+    int wdfd = open(wd.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC); // NOLINT
+
+    if (wdfd == -1) {
+        return false;
+    }
+
+    auto check = [&](const IndexFile::entry_t &e, const struct stat *st) {
+        std::string path(e.path, e.pathlen);
+        struct stat own = {0};
+
+        if (st == nullptr && fstatat(wdfd, path.c_str(), &own, AT_SYMLINK_NOFOLLOW) == 0) {
+            st = &own;
+        }
+
+        if (unchanged(index, e, st, trustctime, filemode)) {
+            clean.push_back({path, GIT_ISTRACKED, GIT_ISTRACKED});
+        } else {
+            changed.push_back(path);
+        }
+    };
+
+    for (size_t i = first; i < last; ++i) {
+        IndexFile::entry_t e = index.entry(i);
+        std::string path(e.path, e.pathlen);
+
+        uint32_t mode = be32(e.data + 24); // NOLINT
+
+        // submodules are left out of status scans altogether
+        if (mode == INDEX_MODE_GITLINK) {
+            continue;
+        }
+
+        if ((e.flags & ENTRY_STAGE) != 0 || (e.extended & ENTRY_INTENT_TO_ADD) != 0) {
+            changed.push_back(path);
+            continue;
+        }
+
+        // entries git itself does not look at in the work tree
+        if ((e.flags & ENTRY_ASSUME_VALID) != 0 || (e.extended & ENTRY_SKIP_WORKTREE) != 0) {
+            clean.push_back({path, GIT_ISTRACKED, GIT_ISTRACKED});
+            continue;
+        }
+
+        // git saw it unchanged and nothing touched it since
+        if (watched && !dirty[i]) {
+            clean.push_back({path, GIT_ISTRACKED, GIT_ISTRACKED});
+            continue;
+        }
+
+        if (hints != nullptr && path.find('/', prefix.length()) == std::string::npos) {
+            listed.push_back(i);
+            continue;
+        }
+
+        check(e, nullptr);
+    }
+
+    /*
+     * The scan runs while the directory is still being read, so what the
+     * listing stat'ed is only there once it is done. Entries it listed
+     * from d_type alone are the only ones stat'ed here.
+     */
+    if (!listed.empty()) {
+        const auto &stats = hints->get();
+
+        for (size_t i : listed) {
+            IndexFile::entry_t e = index.entry(i);
+            std::string path(e.path, e.pathlen);
+            auto found = stats.find(path);
+
+            check(e, (found != stats.end()) ? &found->second : nullptr);
+        }
+    }
+
+    close(wdfd);
+
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    // mostly stale stat data is better left to one libgit2 pass of the scope
+    if (changed.size() * 2 > last - first) {
+        return false;
+    }
+
+    if (!changed.empty()) {
+        scanstatus(repo, changed, out);
+    }
+
+    out->insert(
+        out->end(),
+        std::make_move_iterator(clean.begin()),
+        std::make_move_iterator(clean.end())
+    );
+
+    return true;
+}
+
+unsigned int dirtystatus(git_repository *repo, const std::string &scope)
+{
+    const char *workdir = git_repository_workdir(repo);
+    IndexFile index;
+
+    if (workdir == nullptr) {
+        return 0;
+    }
+
+    std::string wd = workdir;
+    int wdfd = -1;
+
+    // without a readable index a scan, boiled down and dropped, has to do
+    if (!index.open(std::string(git_repository_path(repo)) + "index") || partial(index) ||
+        (wdfd = open(wd.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) { // NOLINT
+        std::vector<status_t> entries;
+        unsigned int flags = 0;
+
+        scanstatus(repo, {scope}, &entries);
+
+        for (const auto &e : entries) {
+            flags |= e.below;
+        }
+
+        return flags;
+    }
+
+    size_t first = 0;
+    size_t last = 0;
+
+    scoperange(index, scope, &first, &last);
+
+    int trustctime = 1;
+    int filemode = 1;
+
+    statoptions(repo, &trustctime, &filemode);
+
+    std::vector<bool> dirty;
+    bool watched = last - first >= FSMONITOR_MIN_ENTRIES &&
+                   fsmonitored(repo, wd, index, &dirty);
+
+    unsigned int flags = (first < last) ? GIT_ISTRACKED : 0;
+
+    // entries whose stat data disagrees, though their content may not
+    std::vector<std::string> stale;
+    std::vector<size_t> submodules;
+    size_t probes = 0;
+
+    auto changed = [&](const std::vector<std::string> &paths) {
+        std::vector<status_t> entries;
+
+        scanstatus(repo, paths, &entries);
+
+        return std::any_of(entries.begin(), entries.end(), [](const status_t &e) {
+            return (e.below & GIT_DIR_DIRTY) != 0;
+        });
+    };
+
+    for (size_t i = first; i < last && (flags & GIT_DIR_DIRTY) == 0; ++i) {
+        IndexFile::entry_t e = index.entry(i);
+
+        // submodules take opening, so they come last
+        if (be32(e.data + 24) == INDEX_MODE_GITLINK) { // NOLINT
+            submodules.push_back(i);
+            continue;
+        }
+
+        if ((e.flags & ENTRY_ASSUME_VALID) != 0 || (e.extended & ENTRY_SKIP_WORKTREE) != 0 ||
+            (watched && !dirty[i])) {
+            continue;
+        }
+
+        struct stat st = {0};
+
+        if ((e.flags & ENTRY_STAGE) == 0 && (e.extended & ENTRY_INTENT_TO_ADD) == 0 &&
+            fstatat(wdfd, e.path, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            unchanged(index, e, &st, trustctime, filemode)) {
+            continue;
+        }
+
+        std::string path(e.path, e.pathlen);
+
+        // most files whose stat data changed have changed, so stop there
+        if (probes < DIRTY_PROBES_MAX) {
+            probes++;
+
+            if (changed({path})) {
+                flags |= GIT_DIR_DIRTY;
+            }
+        } else {
+            stale.push_back(path);
+        }
+    }
+
+    close(wdfd);
+
+    if ((flags & GIT_DIR_DIRTY) == 0 && !stale.empty() && changed(stale)) {
+        flags |= GIT_DIR_DIRTY;
+    }
+
+    // as in RepoStatus, a submodule is dirty off its recorded commit or with changes
+    for (size_t k = 0; k < submodules.size() && (flags & GIT_DIR_DIRTY) == 0; ++k) {
+        IndexFile::entry_t e = index.entry(submodules[k]);
+        git_repository *sub = nullptr;
+
+        // not checked out, nothing to compare against
+        if (git_repository_open_ext(
+                &sub, (wd + e.path).c_str(),
+                GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr) != GIT_OK) {
+            continue;
+        }
+
+        git_oid recorded;
+        git_oid head;
+
+        git_oid_fromraw(&recorded, e.data + ENTRY_OID_OFFSET);
+
+        if (git_reference_name_to_id(&head, sub, "HEAD") != GIT_OK ||
+            git_oid_cmp(&head, &recorded) != 0 ||
+            (dirtystatus(sub, "") & GIT_DIR_DIRTY) != 0) {
+            flags |= GIT_DIR_DIRTY;
+        }
+
+        git_repository_free(sub);
+    }
+
+    return flags;
+}
+
+#endif
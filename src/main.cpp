@@ -4,6 +4,7 @@
 
 extern "C" {
 #include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <pwd.h>
@@ -24,16 +25,45 @@ extern "C" {
     #include <omp.h>
 #endif
 
+#include <atomic>
 #include <cstdio>
+#include <deque>
+#include <future>
+#include <map>
 #include <vector>
 #include <unordered_map>
 
 #include <gsl-lite.hpp>
+#include "cache.hpp"
+#include "dir.hpp"
 #include "entry.hpp"
+#include "git.hpp"
+#include "pool.hpp"
 
 using FileList = std::vector<Entry *>;
 using DirList = std::unordered_map<std::string, FileList>;
-using FlagsList = std::unordered_map<std::string, unsigned int>;
+
+// an entry waiting for the status of the repository it was listed in
+struct pending_t {
+    Entry *entry;
+    // relative to the work directory
+    std::string path;
+    bool isdir;
+    // also takes the flags of what is below it
+    bool below;
+    // lstat data from the listing, when it stat'ed the entry
+    struct stat st;
+    bool stated;
+};
+
+using PendingList = std::vector<pending_t>;
+
+// entries handed to one worker task at a time
+#define BATCH_SLICE 64
+
+// entries listed, and how many of them from d_type alone, for --cache-stats
+static std::atomic<size_t> listed = {0};
+static std::atomic<size_t> typed = {0};
 
 static re2::RE2 git_re("/\\.git/?$");
 
@@ -166,114 +196,217 @@ static std::string relpath(const char *can_fname, const char *can_relative_to)
 }
 
 #ifdef USE_GIT
-unsigned int dirflags(git_repository *repo, std::string rp, std::string path)
+/*
+ * Opens the repository path belongs to and sets scope to path relative to
+ * its work directory. Returns nullptr outside of any repository.
+ */
+static git_repository *openrepo(const std::string &path, std::string *scope)
+{
+    char dirpath[PATH_MAX] = {0};
+    char rppath[PATH_MAX] = {0};
+
+    scope->clear();
+
+    if (realpath(path.c_str(), &dirpath[0]) == nullptr) {
+        return nullptr;
+    }
+
+    std::string root = repofinder.find(&dirpath[0]);
+
+    if (root.empty()) {
+        return nullptr;
+    }
+
+    git_repository *repo = nullptr;
+
+    int error = git_repository_open_ext(
+                    &repo,
+                    root.c_str(),
+                    GIT_REPOSITORY_OPEN_NO_SEARCH,
+                    nullptr
+                );
+
+    if (error < 0) {
+        if (error != GIT_ENOTFOUND) {
+            fprintf(stderr, "Unable to open git repository at %s\n", root.c_str());
+        }
+
+        return nullptr;
+    }
+
+    const char *wd = git_repository_workdir(repo);
+
+    if (
+        wd != nullptr &&
+        realpath(wd, &rppath[0]) != nullptr &&
+        path_prefix(&rppath[0], &dirpath[0])
+    ) {
+        std::string relp = relpath(&dirpath[0], &rppath[0]);
+
+        if (relp != ".") {
+            *scope = relp;
+        }
+    }
+
+    return repo;
+}
+
+// whether dirflags() has a repository to look at for path
+static bool hasrepo(const std::string &path)
+{
+    char dirpath[PATH_MAX] = {0};
+
+    return realpath(path.c_str(), &dirpath[0]) != nullptr &&
+           !repofinder.find(&dirpath[0]).empty();
+}
+
+/*
+ * Flags of a directory that is not part of the listed directory's
+ * repository, but may be (inside) a repository of its own.
+ */
+unsigned int dirflags(const std::string &path)
 {
-    unsigned char flags = GIT_DIR_CLEAN;
+    unsigned int flags = GIT_DIR_CLEAN;
 
     if (!settings.resolve_repos) {
         return flags;
     }
 
-    bool isrepo = false;
-    int error;
+    std::string scope;
+    git_repository *repo = openrepo(path, &scope);
 
-    git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+    if (repo == nullptr) {
+        return NO_FLAGS;
+    }
 
-    opts.show = GIT_STATUS_SHOW_WORKDIR_ONLY;
-    opts.flags = (
-                     GIT_STATUS_OPT_UPDATE_INDEX |
-                     GIT_STATUS_OPT_RENAMES_HEAD_TO_INDEX |
-                     GIT_STATUS_OPT_INCLUDE_UNMODIFIED |
-                     GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH |
-                     GIT_STATUS_OPT_EXCLUDE_SUBMODULES
-                 );
+    if (git_repository_workdir(repo) == nullptr) {
+        flags |= GIT_ISREPO | GIT_DIR_BARE;
+    } else {
+        if (scope.empty()) {
+            flags |= GIT_ISREPO;
+        }
 
-    if (repo == nullptr || exists((rp  + path + "/.git").c_str())) {
-        isrepo = true;
+        // a badge is all it gets, not worth a status of every path
+        flags |= dirtystatus(repo, scope);
+    }
 
-        opts.flags = GIT_STATUS_OPT_UPDATE_INDEX |
-            GIT_STATUS_OPT_RENAMES_HEAD_TO_INDEX |
-            GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
+    git_repository_free(repo);
 
-        git_buf root = { nullptr };
+    return flags;
+}
 
-        error = git_repository_discover(&root, (rp + path).c_str(), 0, nullptr);
+/*
+ * Git flags for the files given on the command line. They are grouped by
+ * the repository they are in, and each repository is scanned once on the
+ * pool, for the narrowest subtree that holds all of its files.
+ */
+static void fileflags(const std::vector<std::pair<Entry *, std::string>> &args)
+{
+    if (!settings.resolve_in_repos) {
+        return;
+    }
 
-        if (error == 0 && root.ptr != nullptr) {
-            error = git_repository_open_ext(
-                    &repo,
-                    root.ptr,
-                    GIT_REPOSITORY_OPEN_FROM_ENV,
-                    nullptr
-                );
+    // absolute paths of the files, by the root of their repository
+    std::map<std::string, std::vector<std::pair<Entry *, std::string>>> repos;
 
-            if (error == GIT_ENOTFOUND) {
-                git_buf_dispose(&root);
-                return NO_FLAGS;
-            }
+    for (const auto &arg : args) {
+        char dirpath[PATH_MAX] = {0};
 
-            if (error < 0) {
-                fprintf(
-                    stderr,
-                    "Unable to open git repository at %s\n",
-                    root.ptr
-                );
-                git_buf_dispose(&root);
-                return NO_FLAGS;
-            }
+        // the file itself may be a link, which is what git tracks
+        size_t slash = arg.second.rfind('/');
+        std::string dir = (slash == std::string::npos) ? "." :
+                          (slash == 0) ? "/" : arg.second.substr(0, slash);
 
-            const char *wd = git_repository_workdir(repo);
-            if (wd == nullptr) {
-                return GIT_ISREPO | GIT_DIR_BARE;
-            }
-            rp = wd;
-        } else {
-            git_buf_dispose(&root);
-            return NO_FLAGS;
+        if (realpath(dir.c_str(), &dirpath[0]) == nullptr) {
+            continue;
         }
 
-        flags |= GIT_ISREPO;
+        std::string root = repofinder.find(&dirpath[0]);
 
-        path.replace(path.begin(), path.begin() + rp.length(), "");
-        git_buf_dispose(&root);
+        if (root.empty()) {
+            continue;
+        }
+
+        std::string path = &dirpath[0];
+
+        if (path.back() != '/') {
+            path += '/';
+        }
+
+        path += arg.second.substr(slash + 1);
+
+        arg.first->setflags(GIT_UNKNOWN);
+        repos[root].emplace_back(arg.first, path);
     }
 
-    if (repo != nullptr) {
-        opts.pathspec.count = 1;
+    for (const auto &r : repos) {
+        std::string root = r.first;
+        auto files = r.second;
 
-        opts.pathspec.strings = new char *[1];
-        opts.pathspec.strings[0] = const_cast<char *>(path.c_str());
+        gitpool.submit([root, files]() {
+            char rppath[PATH_MAX] = {0};
+            git_repository *repo = nullptr;
 
-        git_status_list *statuses = nullptr;
-        error = git_status_list_new(&statuses, repo, &opts);
+            PendingList found;
+            std::string scope;
 
-        if (error == 0 && statuses != nullptr) {
-            for (size_t i = 0; i < git_status_list_entrycount(statuses); i++) {
-                const git_status_entry *entry = git_status_byindex(statuses, i);
-                flags |= GIT_ISTRACKED;
+            if (git_repository_open_ext(
+                    &repo, root.c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr) == GIT_OK) {
+                const char *wd = git_repository_workdir(repo);
 
-                if (entry->status != 0) {
-                    flags |= GIT_DIR_DIRTY;
-                    break;
+                if (wd != nullptr && realpath(wd, &rppath[0]) != nullptr) {
+                    for (const auto &f : files) {
+                        if (!path_prefix(&rppath[0], f.second.c_str())) {
+                            continue;
+                        }
+
+                        std::string path = relpath(f.second.c_str(), &rppath[0]);
+                        size_t slash = path.rfind('/');
+                        std::string dir = (slash == std::string::npos) ? "" : path.substr(0, slash);
+
+                        // shorten scope to the directories it has in common with dir
+                        if (found.empty()) {
+                            scope = dir;
+                        }
+
+                        while (!scope.empty() && dir != scope &&
+                               dir.compare(0, scope.length() + 1, scope + "/") != 0) {
+                            size_t up = scope.rfind('/');
+                            scope = (up == std::string::npos) ? "" : scope.substr(0, up);
+                        }
+
+                        found.push_back({f.first, path, false, false});
+                    }
                 }
             }
 
-            git_status_list_free(statuses);
-        }
+            auto status = found.empty() ? nullptr : gitstatus.get(repo, scope);
 
-        if (isrepo) {
             git_repository_free(repo);
-        }
-    } else {
-        return NO_FLAGS;
-    }
 
-    return flags;
+            gitpool.deliver([files, found, status]() {
+                // what is not in the work tree gets no git column, as before
+                for (const auto &f : files) {
+                    f.first->setflags(NO_FLAGS);
+                }
+
+                for (const auto &e : found) {
+                    e.entry->setflags(status->file(e.path, e.isdir));
+                }
+            });
+        });
+    }
 }
 #endif
 
-Entry *addfile(const char *fpath, const char *file, git_repository *repo,
-               const std::string &rp, const FlagsList &flagsList)
+/*
+ * Builds the entry for file in fpath. Inside a repository, pending is
+ * where the entry is queued for its git flags, which are filled in once
+ * the status is ready.
+ */
+Entry *addfile(const char *fpath, const char *file, int dirfd,
+               const struct stat *prestat, PendingList *pending,
+               const std::string &prefix)
 {
     struct stat st = {0};
     std::string directory = fpath;
@@ -286,24 +419,30 @@ Entry *addfile(const char *fpath, const char *file, git_repository *repo,
 
     stbsp_snprintf(fullpath, PATH_MAX, "%s%s", directory.c_str(), file);
 
-    if ((lstat(&fullpath[0], &st)) < 0) {
+    if (prestat != nullptr) {
+        st = *prestat;
+    } else if ((statat(dirfd, file, &st)) < 0) {
         fprintf(stderr, "Unable to get stats for %s\n", &fullpath[0]);
         return nullptr;
     }
 
+    bool islink = false;
+
     #ifdef S_ISLNK
 
-    if (S_ISLNK(st.st_mode) && settings.resolve_links) {
+    islink = S_ISLNK(st.st_mode); // NOLINT
+
+    if (islink && settings.resolve_links) {
         char target[PATH_MAX] = {};
 
-        if ((readlink(&fullpath[0], &target[0], sizeof(target))) >= 0) {
+        if ((readlinkat(dirfd, file, &target[0], sizeof(target) - 1)) >= 0) {
             std::string lpath = &target[0];
 
             if (lpath.at(0) != '/') {
                 lpath = std::string(dirname(&fullpath[0])) + "/" + lpath;
             }
 
-            if ((lstat(lpath.c_str(), &st)) < 0) {
+            if ((statcache.lstat(lpath, &st)) < 0) {
                 fprintf(
                     stderr,
                     "cannot access '%s': No such file or directory\n",
@@ -320,196 +459,328 @@ Entry *addfile(const char *fpath, const char *file, git_repository *repo,
     #endif /* S_ISLNK */
 
     unsigned int flags = ~0;
+    bool scan = false;
+    bool below = false;
 
     #ifdef USE_GIT
 
-    if (repo != nullptr && settings.resolve_in_repos) {
-        char dirpath[PATH_MAX] = {0};
+    bool isdir = S_ISDIR(st.st_mode) && !islink; // NOLINT
 
-        if (
-            realpath((directory + file).c_str(), &dirpath[0]) == nullptr &&
-            !S_ISLNK(st.st_mode)
-        ) {
-            fprintf(
-                stderr,
-                "cannot access '%s': No such file or directory\n",
-                file
-            );
+    if (pending != nullptr && settings.resolve_in_repos) {
+        std::string lfpath = prefix + file;
 
-            return new Entry(file, &fullpath[0], nullptr, 0);
-        }
+        flags = 0;
 
-        if (flagsList.count(&dirpath[0]) > 0) {
-            flags = flagsList.at(&dirpath[0]);
-        } else {
+        if (isdir && lfpath != ".git" && settings.resolve_repos) {
+            if (exists((directory + file + "/.git").c_str())) {
+                scan = true;
+            } else {
+                below = true;
+            }
+        }
+    } else if (S_ISDIR(st.st_mode)) { // NOLINT
+        if (!settings.resolve_repos) {
+            flags = GIT_DIR_CLEAN;
+        } else if (hasrepo(directory + file)) {
             flags = 0;
+            scan = true;
         }
+    }
 
-        if (!S_ISLNK(st.st_mode)) {
-            std::string lfpath = &dirpath[0];
-            lfpath.replace(lfpath.begin(), lfpath.begin() + rp.length(), "");
+    #else
 
-            if (lfpath.length() > 0) {
-                while (lfpath.at(0) == '/') {
-                    lfpath.replace(lfpath.begin(), lfpath.begin() + 1, "");
-                }
-            }
+    (void)islink;
 
-            if (S_ISDIR(st.st_mode) && lfpath != ".git") {
-                flags |= dirflags(repo, rp, lfpath);
-            }
+    #endif
+
+    auto *entry = new Entry(file, &fullpath[0], &st, flags);
+
+    #ifdef USE_GIT
+
+    if (pending != nullptr && settings.resolve_in_repos) {
+        pending->push_back({entry, prefix + file, isdir, below});
+    }
+
+    /*
+     * Repositories of their own are scanned on the pool, each with its own
+     * handle, while the listing carries on. Until the scan delivers, the
+     * entry shows as unknown.
+     */
+    if (scan) {
+        std::string dirpath = directory + file;
+
+        entry->setflags(flags | GIT_UNKNOWN);
+
+        gitpool.submit([entry, dirpath, flags]() {
+            unsigned int found = dirflags(dirpath);
+
+            gitpool.deliver([entry, flags, found]() {
+                entry->setflags(flags | found);
+            });
+        });
+    }
+
+    #else
+
+    (void)scan;
+    (void)below;
+    (void)pending;
+    (void)prefix;
+
+    #endif
+
+    return entry;
+}
+
+static void addbatch(const char *path, int dirfd, const DirEntry *batch,
+                     size_t count, PendingList *waiting,
+                     const std::string &prefix, FileList *out)
+{
+    std::vector<const DirEntry *> ents;
+
+    for (size_t i = 0; i < count; ++i) {
+        const DirEntry &ent = batch[i];
+
+        if (strcmp(ent.name, ".") == 0 || strcmp(ent.name, "..") == 0) {
+            continue;
         }
-    } else {
-        if (S_ISDIR(st.st_mode)) {
-            flags = dirflags(nullptr, "", directory + file);
+
+        if (ent.name[0] == '.' && !settings.show_hidden) {
+            continue;
         }
+
+        ents.push_back(&ent);
     }
 
-    #endif
+    size_t iMax = ents.size();
+
+    std::vector<struct stat> stats(iMax);
+    std::vector<bool> failed(iMax, false);
+
+    std::vector<size_t> pending;
+    std::vector<const char *> names;
+
+    // entries whose d_type says it all are classified without a stat
+    for (size_t i = 0; i < iMax; ++i) {
+        if (needstat(ents[i]->type)) {
+            pending.push_back(i);
+            names.push_back(ents[i]->name);
+        } else {
+            stats[i].st_mode = DTTOIF(ents[i]->type);
+            stats[i].st_ino = ents[i]->ino;
+        }
+    }
+
+    listed += iMax;
+    typed += iMax - pending.size();
+
+    std::vector<struct stat> pstats(pending.size());
+    std::vector<int> results(pending.size());
+
+    bool prestat = statbatch(
+                       dirfd,
+                       names.data(),
+                       names.size(),
+                       pstats.data(),
+                       results.data()
+                   );
+
+    // one at a time then, but still here so the results can be handed on
+    for (size_t j = 0; !prestat && j < pending.size(); ++j) {
+        results[j] = (statat(dirfd, names[j], &pstats[j]) == 0) ? 0 : -errno;
+    }
+
+    for (size_t j = 0; j < pending.size(); ++j) {
+        if (results[j] == 0) {
+            stats[pending[j]] = pstats[j];
+        } else {
+            // failed already, stat'ing it again would not help
+            failed[pending[j]] = true;
+        }
+    }
+
+    out->reserve(iMax);
+
+    for (size_t i = 0; i < iMax; ++i) {
+        if (failed[i]) {
+            fprintf(stderr, "Unable to get stats for %s/%s\n", path, ents[i]->name);
+            continue;
+        }
+
+        auto f = addfile(
+                     path,
+                     ents[i]->name,
+                     dirfd,
+                     &stats[i],
+                     waiting,
+                     prefix
+                 );
 
-    return new Entry(file, &fullpath[0], &st, flags);
+        if (f == nullptr) {
+            continue;
+        }
+
+        out->push_back(f);
+
+        // what was stat'ed saves the status scan another lstat
+        if (
+            waiting != nullptr && !waiting->empty() &&
+            waiting->back().entry == f && needstat(ents[i]->type)
+        ) {
+            waiting->back().st = stats[i];
+            waiting->back().stated = true;
+        }
+    }
 }
 
 FileList listdir(const char *path)
 {
     FileList lst;
-    DIR *dir;
+    DirReader dir(path);
 
-    char rppath[PATH_MAX] = {0};
+    if (dir.isopen()) {
+        bool inrepo = false;
+        std::string prefix;
 
-    if ((dir = opendir(path)) != nullptr) {
-        dirent *ent;
+        #ifdef USE_GIT
+        auto repostatus = std::make_shared<std::shared_ptr<const RepoStatus>>();
+        std::promise<std::unordered_map<std::string, struct stat>> liststats;
+        std::string scope;
 
-        std::string rp;
-        git_repository *repo = nullptr;
-        FlagsList flagsList = {};
+        git_repository *repo = openrepo(path, &scope);
 
-        #ifdef USE_GIT
-        git_buf root = { nullptr };
+        if (repo != nullptr && git_repository_workdir(repo) == nullptr) {
+            git_repository_free(repo);
+        } else if (repo != nullptr) {
+            if (!scope.empty()) {
+                prefix = scope + "/";
+            }
 
-        int error = -1;
+            /*
+             * Only the listed subtree is scanned, once per run, on the pool
+             * while the directory is read and stat'ed below.
+             */
+            StatHints hints = liststats.get_future();
 
-        char dirpath[PATH_MAX] = {0};
+            gitpool.submit([repo, scope, repostatus, hints]() {
+                auto found = gitstatus.get(repo, scope, &hints);
+                git_repository_free(repo);
 
-        error = git_repository_open_ext(
-                    &repo,
-                    nullptr,
-                    GIT_REPOSITORY_OPEN_FROM_ENV,
-                    nullptr
-                );
+                gitpool.deliver([repostatus, found]() {
+                    *repostatus = found;
+                });
+            });
 
-        if (error == 0) {
-            const char *wd = git_repository_workdir(repo);
+            inrepo = true;
+        }
 
-            if (wd != nullptr) {
-                rp = wd;
+        #endif
 
-                if (realpath(path, &dirpath[0]) == nullptr) {
-                    git_repository_free(repo);
-                    return lst;
-                }
+        std::deque<DirBatch> batches;
+        std::deque<FileList> results;
+        std::deque<PendingList> pendings;
+
+        /*
+         * One thread enumerates the directory and hands out slices of each
+         * getdents batch as tasks; the workers stat and format their slice
+         * into a list of its own. The lists are merged in enumeration order
+         * afterwards, so the result does not depend on the thread count.
+         */
+        #pragma omp parallel shared(batches, results, pendings)
+        #pragma omp single
+        {
+            while (true) {
+                batches.emplace_back();
 
-                if (realpath(rp.c_str(), &rppath[0]) == nullptr) {
-                    git_repository_free(repo);
-                    return lst;
+                if (!dir.next(&batches.back())) {
+                    batches.pop_back();
+                    break;
                 }
 
-                if (!path_prefix(&rppath[0], &dirpath[0])) {
-                    repo = nullptr;
-                } else {
-                    int ignored = 0;
-                    std::string relp = relpath(&dirpath[0], &rppath[0]);
-
-                    git_status_should_ignore(&ignored, repo, relp.c_str());
-                    if (ignored != 1) {
-                        unsigned int flags = 0;
-                        git_status_file(&flags, repo, relp.c_str());
-                    }
+                const DirBatch *batch = &batches.back();
+
+                for (size_t i = 0; i < batch->size(); i += BATCH_SLICE) {
+                    results.emplace_back();
+                    pendings.emplace_back();
+
+                    FileList *out = &results.back();
+                    PendingList *pending = inrepo ? &pendings.back() : nullptr;
+                    size_t end = std::min(i + BATCH_SLICE, batch->size());
+
+                    #pragma omp task firstprivate(batch, out, pending, i, end) shared(dir, prefix)
+                    addbatch(
+                        path,
+                        dir.fd(),
+                        &(*batch)[i],
+                        end - i,
+                        pending,
+                        prefix,
+                        out
+                    );
                 }
             }
+        }
 
-            if (repo == nullptr) {
-                rp = "";
-                error = -1;
-            }
+        size_t total = 0;
+
+        for (const auto &r : results) {
+            total += r.size();
         }
 
-        if (repo != nullptr) {
-            git_status_options opts = GIT_STATUS_OPTIONS_INIT;
-            opts.flags = (
-                             GIT_STATUS_OPT_INCLUDE_IGNORED |
-                             GIT_STATUS_OPT_INCLUDE_UNMODIFIED |
-                             /* GIT_STATUS_OPT_INCLUDE_UNTRACKED | */
-                             GIT_STATUS_OPT_EXCLUDE_SUBMODULES |
-                             GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH
-                         );
-
-            git_status_list *list;
-
-            if (realpath(rp.c_str(), &rppath[0]) != nullptr) {
-                if (git_status_list_new(&list, repo, &opts) == GIT_OK) {
-                    size_t iMax = git_status_list_entrycount(list);
-                    char checkpath[PATH_MAX] = {0};
-
-                    #pragma omp parallel for shared(rp, list, flagsList) private(checkpath)
-                    for (size_t i = 0; i < iMax; ++i) {
-                        const git_status_entry *status = git_status_byindex(list, i);
-                        const char *filePath = (status->head_to_index != nullptr) ?
-                                               status->head_to_index->new_file.path :
-                                               (status->index_to_workdir != nullptr) ?
-                                               status->index_to_workdir->new_file.path :
-                                               nullptr;
-
-
-                        if (filePath != nullptr) {
-                            std::string relp = rp + "/" + filePath;
-
-                            if (realpath(relp.c_str(), &checkpath[0]) != nullptr) {
-                                #pragma omp critical
-                                flagsList[&checkpath[0]] = status->status | GIT_ISTRACKED;
-                            }
-                        }
-                    }
+        lst.reserve(total);
 
-                    git_status_list_free(list);
-                }
-            }
+        for (const auto &r : results) {
+            lst.insert(lst.end(), r.begin(), r.end());
         }
 
-        #endif
+        #ifdef USE_GIT
 
-        #pragma omp parallel shared(repo, path, dir, lst, flagsList)
-        while ((ent = readdir((dir))) != nullptr) {
-            if (
-                strcmp(&ent->d_name[0], ".") == 0 ||
-                strcmp(&ent->d_name[0], "..") == 0
-            ) {
-                continue;
+        /*
+         * The scan compares what was stat'ed here with the index instead
+         * of stat'ing it again, it waits for this when it gets that far.
+         */
+        if (inrepo) {
+            std::unordered_map<std::string, struct stat> stats;
+
+            for (const auto &p : pendings) {
+                for (const auto &e : p) {
+                    if (e.stated) {
+                        stats.emplace(e.path, e.st);
+                    }
+                }
             }
 
-            if (ent->d_name[0] == '.' && !settings.show_hidden) {
-                continue;
-            }
+            liststats.set_value(std::move(stats));
+        }
 
-            auto f = addfile(path, &ent->d_name[0], repo, rp, flagsList);
+        gitpool.wait();
 
-            if (f != nullptr) {
-                #pragma omp critical
-                lst.push_back(f);
-            }
-        }
+        if (inrepo) {
+            const RepoStatus *status = (*repostatus != nullptr) ?
+                                       repostatus->get() :
+                                       &RepoStatus::unknown();
 
-        #ifdef USE_GIT
+            size_t jMax = pendings.size();
 
-        if (repo != nullptr) {
-            flagsList.clear();
-            git_repository_free(repo);
-            git_buf_dispose(&root);
+            #pragma omp parallel for
+            for (size_t j = 0; j < jMax; ++j) {
+                for (const auto &e : pendings[j]) {
+                    e.entry->addflags(
+                        status->file(e.path, e.isdir) |
+                        (e.below ? status->dir(e.path) : 0)
+                    );
+                }
+            }
         }
 
         #endif
 
-        closedir(dir);
+        size_t iMax = lst.size();
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < iMax; ++i) {
+            lst[i]->postprocess();
+        }
     }
 
     return lst;
@@ -694,6 +965,8 @@ void loadconfig()
     settings.dirs_first = GETBOOL("settings:dirs_first", 1);
 
     settings.numeric_id = GETBOOL("settings:numeric_id", 0);
+    settings.dont_sync = GETBOOL("settings:dont_sync", 0);
+    settings.preload_ids = GETBOOL("settings:preload_ids", 0);
 
     settings.sort = SORT_ALPHA;
 
@@ -821,6 +1094,10 @@ void loadconfig()
                                        0);
     settings.override_git_dir_color = GETBOOL("settings:override_git_dir_color",
                                       0);
+    settings.git_update_index = GETBOOL("settings:git_update_index", 0);
+    settings.git_cache = GETBOOL("settings:git_cache", 0);
+    settings.git_jobs = GETINT("settings:git_jobs", 0);
+    settings.git_timeout = GETINT("settings:git_timeout", 0);
 
     settings.symbols.git.ignore = GETSTR("symbols:git_ignore", "!");
     settings.symbols.git.conflict = GETSTR("symbols:git_conflict", "X");
@@ -831,6 +1108,7 @@ void loadconfig()
     settings.symbols.git.unreadable = GETSTR("symbols:git_unreadable", "-");
     settings.symbols.git.untracked = GETSTR("symbols:git_untracked", "?");
     settings.symbols.git.unchanged = GETSTR("symbols:git_unchanged", " ");
+    settings.symbols.git.unknown = GETSTR("symbols:git_unknown", "#");
 
     settings.symbols.git.dir_dirty = GETSTR("symbols:git_dir_dirty", "!");
     settings.symbols.git.dir_clean = GETSTR("symbols:git_dir_clean", " ");
@@ -848,6 +1126,7 @@ void loadconfig()
     settings.color.git.unreadable.fg = GETINT("colors:git_unreadable_fg", 9);
     settings.color.git.untracked.fg = GETINT("colors:git_untracked_fg", 8);
     settings.color.git.unchanged.fg = GETINT("colors:git_unchanged_fg", 0);
+    settings.color.git.unknown.fg = GETINT("colors:git_unknown_fg", 13);
 
     settings.color.git.dir_dirty.fg = GETINT("colors:git_dir_dirty_fg", 1);
     settings.color.git.dir_clean.fg = GETINT("colors:git_dir_clean_fg", 0);
@@ -865,6 +1144,7 @@ void loadconfig()
     settings.color.git.unreadable.bg = GETINT("colors:git_unreadable_bg", -1);
     settings.color.git.untracked.bg = GETINT("colors:git_untracked_bg", -1);
     settings.color.git.unchanged.bg = GETINT("colors:git_unchanged_bg", -1);
+    settings.color.git.unknown.bg = GETINT("colors:git_unknown_bg", -1);
 
     settings.color.git.dir_dirty.bg = GETINT("colors:git_dir_dirty_bg", -1);
     settings.color.git.dir_clean.bg = GETINT("colors:git_dir_clean_bg", -1);
@@ -902,6 +1182,9 @@ option long_options[] = {
     {"sort-size", no_argument, nullptr, 'S'},
     {"sort-type", no_argument, nullptr, 'X'},
     {"numeric-uid-gid", no_argument, nullptr, 'n'},
+    {"dont-sync", no_argument, nullptr, 'D'},
+    {"cache-stats", no_argument, nullptr, 'K'},
+    {"git-timeout", required_argument, nullptr, 'T'},
     {nullptr, 0, nullptr, 0}
 };
 
@@ -924,6 +1207,11 @@ int main(int argc, const char *argv[])
     FileList files;
     DirList dirs;
 
+    #ifdef USE_GIT
+    // the git time budget counts from here
+    auto started = WorkerPool::Clock::now();
+    #endif
+
     settings.no_conf = false;
 
 
@@ -932,7 +1220,7 @@ int main(int argc, const char *argv[])
     bool parse = true;
 
     while (parse) {
-        int c = getopt_long(argc, const_cast<char **>(argv), "c:LMGgarfXtSAlnF:C",
+        int c = getopt_long(argc, const_cast<char **>(argv), "c:LMGgarfXtSAlnDKT:F:C",
                             long_options, 0);
 
         switch (c) {
@@ -1001,6 +1289,20 @@ int main(int argc, const char *argv[])
                 settings.numeric_id = !settings.numeric_id;
                 break;
 
+            case 'D':
+                settings.dont_sync = !settings.dont_sync;
+                break;
+
+            case 'K':
+                settings.cache_stats = !settings.cache_stats;
+                break;
+
+            case 'T':
+                #ifdef USE_GIT
+                settings.git_timeout = std::strtol(optarg, nullptr, 10);
+                #endif
+                break;
+
             case 'C':
                 settings.colors = !settings.colors;
                 break;
@@ -1032,6 +1334,22 @@ int main(int argc, const char *argv[])
         initcolors();
     }
 
+    initstat();
+
+    if (settings.preload_ids && !settings.numeric_id) {
+        idcache.preload();
+    }
+
+    #ifdef USE_GIT
+    gitpool.setlimit(std::max(settings.git_jobs, 0));
+
+    if (settings.git_timeout > 0) {
+        gitpool.setdeadline(
+            started + std::chrono::milliseconds(settings.git_timeout)
+        );
+    }
+    #endif
+
     gsl::span<const char *> sp = {};
     const char* single[] = { "." };
 
@@ -1048,15 +1366,17 @@ int main(int argc, const char *argv[])
     if (count > 0) {
         char target[PATH_MAX] = {};
         char fullpath[PATH_MAX] = {0};
-        FlagsList flagsList = {};
-
         struct stat st = {0};
 
-        #pragma omp parallel for shared(dirs, sp, files) private(target, fullpath, flagsList, st)
+        #ifdef USE_GIT
+        std::vector<std::pair<Entry *, std::string>> fileargs;
+        #endif
+
+        // listdir() spreads each directory over all threads itself
         for (uint32_t i = 0; i < count; i++) {
             const char* curr = gsl::at(sp, i);
 
-            if ((lstat(curr, &st)) < 0) {
+            if ((statcache.lstat(curr, &st)) < 0) {
                 fprintf(stderr, "Unable to open %s!\n", curr);
             } else {
                 #ifdef S_ISLNK
@@ -1071,7 +1391,7 @@ int main(int argc, const char *argv[])
                         lpath = std::string(dirname(&fullpath[0])) + "/" + lpath;
                     }
 
-                    lstat(lpath.c_str(), &st);
+                    statcache.lstat(lpath, &st);
                 }
 
                 #endif
@@ -1082,12 +1402,30 @@ int main(int argc, const char *argv[])
                         listdir(curr)
                     ));
                 } else {
-                    files.push_back(
-                        addfile("", curr, nullptr, "", flagsList)
-                    );
+                    auto f = addfile("", curr, AT_FDCWD, nullptr, nullptr, "");
+
+                    if (f != nullptr) {
+                        files.push_back(f);
+
+                        #ifdef USE_GIT
+                        fileargs.emplace_back(f, curr);
+                        #endif
+                    }
                 }
             }
         }
+
+        #ifdef USE_GIT
+        fileflags(fileargs);
+        #endif
+    }
+
+    #ifdef USE_GIT
+    gitpool.wait();
+    #endif
+
+    for (auto f : files) {
+        f->postprocess();
     }
 
     #pragma omp taskwait
@@ -1115,7 +1453,30 @@ int main(int argc, const char *argv[])
     files.clear();
     dirs.clear();
 
+    if (settings.cache_stats) {
+        fprintf(
+            stderr,
+            "stat cache: %zu lookups, %zu hits\n",
+            statcache.lookups(),
+            statcache.hits()
+        );
+
+        fprintf(
+            stderr,
+            "d_type: %zu of %zu entries without a stat\n",
+            typed.load(),
+            listed.load()
+        );
+    }
+
     #ifdef USE_GIT
+
+    // scans still running past the deadline are not waited for
+    if (gitpool.abandoned()) {
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+
     git_libgit2_shutdown();
     #endif
 
@@ -0,0 +1,192 @@
+#include "pool.hpp"
+
+#include <algorithm>
+#include <memory>
+
+WorkerPool gitpool;
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+
+    queued.notify_all();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void WorkerPool::setlimit(size_t threads)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    this->limit = threads;
+}
+
+void WorkerPool::setdeadline(Clock::time_point deadline)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    this->deadline = deadline;
+    this->timed = true;
+}
+
+void WorkerPool::submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (expired) {
+            return;
+        }
+
+        if (limit == 0) {
+            limit = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        jobs.push_back(std::move(job));
+
+        if (threads.size() < limit && busy + jobs.size() > threads.size()) {
+            threads.emplace_back(&WorkerPool::work, this);
+        }
+    }
+
+    queued.notify_one();
+}
+
+bool WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    auto done = [this]() {
+        return expired || (jobs.empty() && busy == 0);
+    };
+
+    if (!timed) {
+        drained.wait(guard, done);
+    } else if (!drained.wait_until(guard, deadline, done)) {
+        expired = true;
+        jobs.clear();
+    }
+
+    return !expired;
+}
+
+void WorkerPool::run(const std::vector<std::function<void()>> &group)
+{
+    struct group_t {
+        std::vector<std::function<void()>> jobs;
+        std::vector<bool> claimed;
+        size_t running = 0;
+
+        std::mutex lock;
+        std::condition_variable finished;
+    };
+
+    // queued jobs outlive the call when the caller gets to them first
+    auto shared = std::make_shared<group_t>();
+    shared->jobs = group;
+    shared->claimed.assign(group.size(), false);
+
+    for (size_t i = 0; i < group.size(); ++i) {
+        submit([shared, i]() {
+            {
+                std::lock_guard<std::mutex> guard(shared->lock);
+
+                if (shared->claimed[i]) {
+                    return;
+                }
+
+                shared->claimed[i] = true;
+                shared->running++;
+            }
+
+            shared->jobs[i]();
+
+            {
+                std::lock_guard<std::mutex> guard(shared->lock);
+                shared->running--;
+            }
+
+            shared->finished.notify_all();
+        });
+    }
+
+    for (size_t i = 0; i < group.size(); ++i) {
+        {
+            std::lock_guard<std::mutex> guard(shared->lock);
+
+            if (shared->claimed[i]) {
+                continue;
+            }
+
+            shared->claimed[i] = true;
+        }
+
+        if (!abandoned()) {
+            shared->jobs[i]();
+        }
+    }
+
+    // only jobs a worker already runs are left, and they need no one else
+    std::unique_lock<std::mutex> guard(shared->lock);
+
+    shared->finished.wait(guard, [&shared]() {
+        return shared->running == 0;
+    });
+}
+
+bool WorkerPool::deliver(const std::function<void()> &apply)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (expired) {
+        return false;
+    }
+
+    apply();
+
+    return true;
+}
+
+bool WorkerPool::abandoned()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return expired;
+}
+
+void WorkerPool::work()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        queued.wait(guard, [this]() {
+            return stopping || !jobs.empty();
+        });
+
+        if (jobs.empty()) {
+            return;
+        }
+
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        busy++;
+
+        guard.unlock();
+        job();
+        guard.lock();
+
+        busy--;
+
+        if (jobs.empty() && busy == 0) {
+            drained.notify_all();
+        }
+    }
+}
@@ -0,0 +1,85 @@
+// NOLINTNEXTLINE
+#ifndef POOL_HPP_
+#define POOL_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A bounded set of worker threads draining a queue of jobs, for work that
+ * blocks on I/O outside of the OpenMP regions (scanning repositories).
+ * Threads are started as jobs arrive, up to the limit.
+ *
+ * Past its deadline the pool is abandoned: waiting stops, queued jobs are
+ * dropped and whatever running jobs still deliver is thrown away, so the
+ * process has to end without joining them.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool() = default;
+    virtual ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool(WorkerPool &&other) = delete;
+    WorkerPool &operator=(const WorkerPool &other) = delete;
+    WorkerPool &operator=(WorkerPool &&other) = delete;
+
+    // 0 means one thread per CPU
+    void setlimit(size_t threads);
+
+    using Clock = std::chrono::steady_clock;
+
+    void setdeadline(Clock::time_point deadline);
+
+    void submit(std::function<void()> job);
+
+    /*
+     * Blocks until every job submitted so far has finished, or the
+     * deadline passed. Returns false once the pool has been abandoned.
+     */
+    bool wait();
+
+    /*
+     * Runs a group of jobs on the pool and waits for just those. Jobs no
+     * worker has started yet are run by the caller itself, so a job can
+     * run a group without waiting on the threads the pool has. Jobs not
+     * started once the pool is abandoned are skipped.
+     */
+    void run(const std::vector<std::function<void()>> &group);
+
+    /*
+     * Runs apply, which hands a job's result over to the caller, unless
+     * the pool has been abandoned. Returns whether it ran.
+     */
+    bool deliver(const std::function<void()> &apply);
+
+    bool abandoned();
+private:
+    size_t limit = 0;
+    size_t busy = 0;
+    bool stopping = false;
+    bool expired = false;
+
+    bool timed = false;
+    Clock::time_point deadline;
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+
+    std::mutex lock;
+    std::condition_variable queued;
+    std::condition_variable drained;
+
+    void work();
+};
+
+extern WorkerPool gitpool;
+
+#endif // POOL_HPP_
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# With the stock dircolors database an entry is only stat'ed when one of
+# the rules for its type needs the mode bits: su/sg for regular files,
+# tw/ow/st for directories, none for the rest.
+#
+# usage: tests/dircolors.sh [path to lsext]
+
+lsext=${1:-./build/lsext}
+failed=0
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+mkdir "$tmp/home" "$tmp/list" "$tmp/list/dir"
+touch "$tmp/list/file"
+mkfifo "$tmp/list/fifo"
+ln -s file "$tmp/list/link"
+ln -s dir "$tmp/list/dirlink"
+
+# no user configuration, only the defaults
+export HOME="$tmp/home"
+export XDG_CONFIG_HOME="$tmp/home"
+
+eval "$(dircolors -b)"
+stock=$LS_COLORS
+
+# expect <LS_COLORS> <entries without a stat> <description>
+expect()
+{
+    # a format without the names, whose exec suffix needs the mode as well
+    out=$(LS_COLORS=$1 "$lsext" -K -F "@G" "$tmp/list" 2>&1 >/dev/null | grep '^d_type:')
+
+    if [ "$out" = "d_type: $2 of 5 entries without a stat" ]; then
+        echo "ok: $3"
+    else
+        echo "FAIL: $3: expected $2 of 5, got '$out'"
+        failed=1
+    fi
+}
+
+without()
+{
+    echo "$stock" | tr ':' '\n' | grep -v -e "^$1=" -e "^$2=" -e "^$3=" | paste -sd: -
+}
+
+expect "$stock" 3 "stock database stats the file and the directory"
+expect "$(without su sg)" 4 "without su/sg the file is not stat'ed"
+expect "$(without tw ow st)" 4 "without tw/ow/st the directory is not stat'ed"
+expect "" 5 "without LS_COLORS nothing is stat'ed"
+
+exit $failed
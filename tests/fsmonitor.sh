@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# With git_cache on and a core.fsmonitor hook, a reported path that git
+# ignores and does not track leaves the cache alone, even when it sits
+# next to tracked files. A reported tracked file is rescanned, and so is
+# everything when the index changed too recently to tell apart.
+#
+# usage: tests/fsmonitor.sh [path to lsext]
+
+lsext=$(realpath "${1:-./build/lsext}")
+failed=0
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+mkdir "$tmp/home" "$tmp/cache"
+printf '[settings]\ngit_cache = 1\n' > "$tmp/home/lsext.ini"
+
+export HOME="$tmp/home"
+export XDG_CONFIG_HOME="$tmp/home"
+export XDG_CACHE_HOME="$tmp/cache"
+export LS_COLORS=
+
+repo="$tmp/repo"
+git init -q "$repo" || exit 1
+mkdir "$repo/src"
+echo '*.o' > "$repo/.gitignore"
+echo 'int x;' > "$repo/src/foo.c"
+git -C "$repo" add .gitignore src/foo.c
+git -C "$repo" -c user.name=test -c user.email=test@localhost commit -qm init || exit 1
+
+# a version 2 hook reporting whatever the test wrote to $tmp/reported
+cat > "$tmp/hook" <<EOF
+#!/bin/sh
+printf 'token%s\\0' "\$(date +%s%N)"
+tr '\\n' '\\0' < "$tmp/reported"
+EOF
+chmod +x "$tmp/hook"
+: > "$tmp/reported"
+
+git -C "$repo" config core.fsmonitor "$tmp/hook"
+git -C "$repo" config core.fsmonitorhookversion 2
+
+# let the commit age past the cache's racy window
+sleep 2
+
+# status <description> <expected git symbol of foo.c>
+status()
+{
+    out=$("$lsext" -F "@G@F" "$repo/src" | sed 's/\x1b\[[0-9;]*m//g' | grep 'foo\.c')
+
+    if [ "$out" = "$2foo.c " ]; then
+        echo "ok: $1"
+    else
+        echo "FAIL: $1: expected '$2foo.c ', got '$out'"
+        failed=1
+    fi
+}
+
+status "first listing fills the cache" " "
+
+# foo.c changes behind the hook's back, so only a rescan of src sees it
+echo 'int y;' >> "$repo/src/foo.c"
+touch "$repo/src/foo.o"
+echo src/foo.o > "$tmp/reported"
+status "an ignored file next to tracked ones does not rescan" " "
+
+echo src/foo.c > "$tmp/reported"
+status "a tracked file is rescanned" "~"
+
+# staging touches nothing the hook watches, and both index stamps are racy
+: > "$tmp/reported"
+sleep 2
+touch "$repo/.git/index"
+status "a racy index is not cached" "~"
+git -C "$repo" add src/foo.c
+status "staging in a racy index is seen" " "
+
+exit $failed